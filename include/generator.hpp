@@ -7,7 +7,8 @@
 
 namespace generator
 {
-	model::Mob random_mob(Index<model::Team> team, std::size_t size);
+	model::MobData random_mob(int team, std::size_t size, model::Rng& rng);
+	model::Coord random_coord(std::size_t size, model::Rng& rng);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,43 @@
+#ifndef HANDLE_HPP
+#define HANDLE_HPP
+
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+namespace model
+{
+	// Refers to a T owned by some state: the slot it is stored in, plus the
+	// generation of that slot when the handle was made. It's a plain value,
+	// so it stays good when the state is copied or its storage moves, and it
+	// has to be resolved through whichever copy of the state is at hand. The
+	// owner bumps the generation when a slot gets reused, which turns old
+	// handles to it stale instead of silently pointing at something else.
+	template <typename T>
+	struct Handle
+	{
+		static constexpr std::uint32_t none = std::numeric_limits<std::uint32_t>::max();
+
+		std::uint32_t index = none;
+		std::uint32_t generation = 0;
+
+		Handle() = default;
+		Handle(std::uint32_t index, std::uint32_t generation)
+			: index(index), generation(generation) {}
+
+		// Default constructed handles don't refer to anything.
+		bool is_none() const { return index == none; }
+
+		bool operator==(const Handle& rhs) const {
+			return index == rhs.index && generation == rhs.generation;
+		}
+		bool operator!=(const Handle& rhs) const { return !(*this == rhs); }
+	};
+
+	template <typename T>
+	constexpr std::uint32_t Handle<T>::none;
+}
+
+#endif
@@ -7,9 +7,10 @@
 
 class InputManager
 {
-	void mousemove(glm::vec2 pos, model::Mob& player);
-	void left_click(glm::vec2 pos, model::Mob& player);
-	void right_click(glm::vec2 pos, model::Mob& player);
+	void mousemove(glm::vec2 pos, model::Mob player);
+	void left_click(glm::vec2 pos, model::Mob player);
+	void right_click(glm::vec2 pos, model::Mob player);
+	void middle_click(glm::vec2 pos, model::Mob player);
 
 	gl::Camera& camera_;
 	model::GameInstance& game_;
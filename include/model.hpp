@@ -4,10 +4,22 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <cstdint>
 #include <vector>
 #include <iostream>
+#include <limits>
 #include <random>
+// Headless builds of the rules, like the hexmage_sim library, leave out
+// everything that draws and only need the math types from glm.
+#ifdef HEXMAGE_HEADLESS
+#include <glm/glm.hpp>
+#include <format.h>
+#else
 #include <gl_utils.hpp>
+#endif
+#include <handle.hpp>
+#include <rng.hpp>
 #include <boost/optional.hpp>
 
 namespace model
@@ -26,11 +38,18 @@ namespace model
 	class Player;
 	class Arena;
 	class PlayerInfo;
+	class GameState;
 	class GameInstance;
 	class TurnManager;
 
 	int hex_distance(Coord c1, Coord c2);
 
+	// Axial offsets of the six neighbours of a hex, opposite directions are
+	// next to each other.
+	extern const Coord hex_directions[6];
+
+	constexpr int opposite_direction(int direction) { return direction ^ 1; }
+
 	enum class HexType
 	{
 		Empty = 0,
@@ -61,11 +80,11 @@ namespace model
 		int x;
 		int y;
 
-		Coord() : x(0), y(0) {}
+		constexpr Coord() : x(0), y(0) {}
 
 		Coord(const Cube& cube);
 
-		Coord(int x, int y) : x(x), y(y) {}
+		constexpr Coord(int x, int y) : x(x), y(y) {}
 
 		operator Cube() const;
 		Coord abs() const;
@@ -87,6 +106,83 @@ namespace model
 	std::ostream& operator<<(std::ostream& os, const Coord& c);
 
 	constexpr int ABILITY_COUNT = 6;
+	constexpr int MAX_AP = 10;
+	constexpr int MAX_ABILITY_RANGE = 10;
+
+	// AP it costs to step onto a hex. Plain hexes cost the minimum, so a path
+	// is never cheaper than its number of steps, and rough terrain like mud
+	// costs more, up to MAX_MOVE_COST.
+	constexpr int MIN_MOVE_COST = 1;
+	constexpr int MUD_MOVE_COST = 2;
+	constexpr int MAX_MOVE_COST = 4;
+
+	// What a Zobrist key stands for, see zobrist_key.
+	enum class ZobristFeature : std::uint64_t
+	{
+		MobCoord = 1,
+		MobHp,
+		MobAp,
+		Wall,
+		MoveCost,
+		TurnOrder,
+		TurnCursor
+	};
+
+	// Pseudo random key for a single feature of a game state, like mob `a`
+	// standing on hex `b`. The hash of a state is the xor of the keys of all its
+	// features, so a change to one of them is two xors. Instead of tables with
+	// a row per mob for every hex, the key is mixed from the feature with
+	// mix64, which is a bijection, so distinct features never share a key.
+	inline std::uint64_t zobrist_key(ZobristFeature feature, std::uint32_t a, std::uint32_t b) {
+		std::uint64_t z = (static_cast<std::uint64_t>(feature) << 60) ^ (static_cast<std::uint64_t>(a) << 32) ^ b;
+		return mix64(z + 0x9e3779b97f4a7c15ull);
+	}
+
+	inline std::uint64_t zobrist_key(ZobristFeature feature, std::uint32_t a, Coord c) {
+		return zobrist_key(feature, a, (static_cast<std::uint32_t>(c.x) << 16) ^ static_cast<std::uint16_t>(c.y));
+	}
+
+	// Number of hexes at most `radius` steps away from a hex, including itself.
+	constexpr int hex_area(int radius) { return 1 + 3 * radius * (radius + 1); }
+
+	// Offsets of all hexes within `Radius` steps, generated at compile time and
+	// ordered ring by ring. The hexes within distance r are always the first
+	// hex_area(r) entries.
+	template <int Radius>
+	struct SpiralOffsets
+	{
+		Coord offsets[hex_area(Radius)];
+
+		constexpr SpiralOffsets() : offsets() {
+			// Walk each ring starting from its bottom-left corner, one side per direction.
+			const int dx[6] = { 1, 1, 0, -1, -1, 0 };
+			const int dy[6] = { 0, -1, -1, 0, 1, 1 };
+
+			int i = 1;
+			for (int r = 1; r <= Radius; ++r) {
+				int x = -r;
+				int y = r;
+
+				for (int side = 0; side < 6; ++side) {
+					for (int step = 0; step < r; ++step) {
+						offsets[i].x = x;
+						offsets[i].y = y;
+						++i;
+
+						x += dx[side];
+						y += dy[side];
+					}
+				}
+			}
+		}
+
+		constexpr std::size_t size() const { return hex_area(Radius); }
+		constexpr const Coord& operator[](std::size_t i) const { return offsets[i]; }
+	};
+
+	constexpr SpiralOffsets<MAX_AP> spiral_offsets{};
+
+	static_assert(MAX_ABILITY_RANGE <= MAX_AP, "lines of sight are indexed by spiral_offsets");
 
 	struct Position
 	{
@@ -119,24 +215,94 @@ namespace model
 
 	Position mouse2gl(int x, int y);
 
-	// TODO - update this to a proper container
-	template <typename T>
-	struct Matrix
+	// The neighbours of a hex that are inside a `size` x `size` arena, skipping
+	// the ones that would fall off the edge.
+	class HexNeighbours
+	{
+		Coord center_;
+		int size_;
+	public:
+		class iterator
+		{
+			Coord center_;
+			int size_;
+			int direction_;
+
+			bool inside(Coord c) const { return c.x >= 0 && c.y >= 0 && c.x < size_ && c.y < size_; }
+
+			void skip() {
+				while (direction_ < 6 && !inside(center_ + hex_directions[direction_])) {
+					direction_++;
+				}
+			}
+		public:
+			iterator(Coord center, int size, int direction) : center_(center), size_(size), direction_(direction) { skip(); }
+
+			Coord operator*() const { return center_ + hex_directions[direction_]; }
+			// Index into hex_directions of the current neighbour.
+			int direction() const { return direction_; }
+
+			iterator& operator++() {
+				direction_++;
+				skip();
+				return *this;
+			}
+
+			bool operator==(const iterator& rhs) const { return direction_ == rhs.direction_; }
+			bool operator!=(const iterator& rhs) const { return direction_ != rhs.direction_; }
+		};
+
+		HexNeighbours(Coord center, std::size_t size) : center_(center), size_(static_cast<int>(size)) {}
+
+		iterator begin() const { return{ center_, size_, 0 }; }
+		iterator end() const { return{ center_, size_, 6 }; }
+	};
+
+	// Hexes stored row after row.
+	struct RowMajorLayout
 	{
-		std::size_t m;
-		std::size_t n;
-		std::vector<T> vs;
+		static std::size_t capacity(std::size_t size) { return size * size; }
+		static std::size_t index(Coord c, std::size_t size) { return c.y * size + c.x; }
+	};
 
-		Matrix(std::size_t m, std::size_t n) : m(m), n(n), vs(m * n) {}
+	// One value for every hex of a `size` x `size` arena and nothing else,
+	// in the order given by `Layout`.
+	template <typename T, typename Layout = RowMajorLayout>
+	class HexGrid
+	{
+		std::size_t size_;
+		std::vector<T> cells_;
+	public:
+		explicit HexGrid(std::size_t size = 0, const T& value = T())
+			: size_(size), cells_(Layout::capacity(size), value) {}
 
-		// Create a matrix that can contain data for a hex with radius `size`
-		Matrix(std::size_t size) : Matrix(size * 2 + 1, size * 2 + 1) {}
+		std::size_t size() const { return size_; }
 
-		T& operator()(std::size_t i, std::size_t j) { return vs[n * i + j]; }
-		T& operator()(const Coord& c) { return vs[n * c.y + c.x]; }
+		bool contains(Coord c) const {
+			return c.x >= 0 && c.y >= 0 && c.x < static_cast<int>(size_) && c.y < static_cast<int>(size_);
+		}
 
-	private:
-	}; /* column-major/opengl: vs[i + m * j], row-major/c++: vs[n * i + j] */
+		// Position of `c` in the storage, for side tables kept in the same order.
+		std::size_t index(Coord c) const {
+			assert(contains(c));
+			return Layout::index(c, size_);
+		}
+
+		T& operator()(Coord c) { return cells_[index(c)]; }
+		const T& operator()(Coord c) const { return cells_[index(c)]; }
+
+		void fill(const T& value) { std::fill(cells_.begin(), cells_.end(), value); }
+
+		HexNeighbours neighbours(Coord c) const { return{ c, size_ }; }
+
+		// Every cell in storage order, including any padding of the layout.
+		typename std::vector<T>::iterator begin() { return cells_.begin(); }
+		typename std::vector<T>::iterator end() { return cells_.end(); }
+		typename std::vector<T>::const_iterator begin() const { return cells_.begin(); }
+		typename std::vector<T>::const_iterator end() const { return cells_.end(); }
+
+		std::size_t memory() const { return cells_.capacity() * sizeof(T); }
+	};
 
 	struct Color
 	{
@@ -162,9 +328,12 @@ namespace model
 		int d_hp;
 		int d_ap;
 		int cost;
-		int range = 5;
+		int range;
 
-		Ability(int d_hp, int d_ap, int cost) : d_hp(d_hp), d_ap(d_ap), cost(cost) {}
+		// Left uninitialized, so the unused slots of a MobTable cost nothing.
+		Ability() = default;
+		Ability(int d_hp, int d_ap, int cost, int range = 5)
+			: d_hp(d_hp), d_ap(d_ap), cost(cost), range(range) {}
 	};
 
 	inline std::ostream& operator<<(std::ostream& os, const Ability& ability) {
@@ -172,70 +341,467 @@ namespace model
 			<< "/" << ability.d_ap << ", range: " << ability.range;
 	}
 
+	constexpr std::size_t MAX_MOBS = 256;
+
+	using MobId = Handle<Mob>;
+
+	// A single mob by value, what the generator creates and PlayerInfo::add_mob takes.
+	class MobData
+	{
+	public:
+		using abilities_t = std::array<Ability, ABILITY_COUNT>;
+		int max_hp;
+		int max_ap;
+
+		int hp;
+		int ap;
+
+		abilities_t abilities;
+		Coord c;
+		int team;
+
+		MobData(int max_hp, int max_ap, const abilities_t& abilities, int team);
+	};
+
+	class MobTable;
+	class Target;
+
+	// A mob stored in a MobTable. The fields refer to the columns of the table,
+	// so changing them changes the mob in the table, while copying a Mob only
+	// copies the references. It's meant to be passed around by value.
+	class Mob
+	{
+	public:
+		using abilities_t = MobData::abilities_t;
+		int& max_hp;
+		int& max_ap;
+
+		int& hp;
+		int& ap;
+
+		abilities_t& abilities;
+		Coord& c;
+		// Id of the team in PlayerInfo::teams.
+		int& team;
+		// Position of the mob in its table.
+		const int index;
+		const std::uint32_t generation;
+
+		Mob(MobTable& table, int index);
+
+		MobId id() const { return MobId(index, generation); }
+
+		bool use_ability(int ability, Target target);
+		void move(GameInstance& arena, Coord d);
+
+		bool can_use_ability_at(Target t, GameInstance& game, const Ability& ability);
+		std::vector<Ability> usable_abilities(Target t, GameInstance& game);
+	};
+
+	// Mobs stored column by column in fixed size arrays. Copying a table never
+	// allocates and only copies the columns up to the last mob, and a loop
+	// over a single column, like the positions, doesn't drag the rest along.
+	class MobTable
+	{
+		std::size_t size_ = 0;
+		std::array<int, MAX_MOBS> max_hp_;
+		std::array<int, MAX_MOBS> max_ap_;
+		std::array<int, MAX_MOBS> hp_;
+		std::array<int, MAX_MOBS> ap_;
+		std::array<MobData::abilities_t, MAX_MOBS> abilities_;
+		std::array<Coord, MAX_MOBS> c_;
+		std::array<int, MAX_MOBS> team_;
+		std::array<std::uint32_t, MAX_MOBS> generation_;
+		// Every mob gets a new generation, so a handle never matches a mob
+		// added after a clear() into the same slot.
+		std::uint32_t next_generation_ = 0;
+
+		friend class Mob;
+	public:
+		class iterator
+		{
+			MobTable* table_;
+			int index_;
+		public:
+			iterator(MobTable* table, int index) : table_(table), index_(index) {}
+
+			Mob operator*() const { return Mob(*table_, index_); }
+			iterator& operator++() { ++index_; return *this; }
+			bool operator!=(const iterator& rhs) const { return index_ != rhs.index_; }
+		};
+
+		MobTable() = default;
+		MobTable(const MobTable& other) { *this = other; }
+		MobTable& operator=(const MobTable& other);
+
+		std::size_t size() const { return size_; }
+		bool empty() const { return size_ == 0; }
+
+		// There is room for MAX_MOBS mobs.
+		Mob push_back(const MobData& mob);
+		// Removes every mob, handles to them won't resolve anymore.
+		void clear() { size_ = 0; }
+
+		Mob operator[](std::size_t i) {
+			assert(i < size_);
+			return Mob(*this, static_cast<int>(i));
+		}
+
+		Mob operator[](MobId id) {
+			assert(contains(id));
+			return Mob(*this, static_cast<int>(id.index));
+		}
+
+		MobId id(std::size_t i) const { return MobId(static_cast<std::uint32_t>(i), generation_[i]); }
+		bool contains(MobId id) const { return id.index < size_ && generation_[id.index] == id.generation; }
+
+		iterator begin() { return{ this, 0 }; }
+		iterator end() { return{ this, static_cast<int>(size_) }; }
+
+		// Read only access to the columns.
+		int max_hp(std::size_t i) const { return max_hp_[i]; }
+		int max_ap(std::size_t i) const { return max_ap_[i]; }
+		int hp(std::size_t i) const { return hp_[i]; }
+		int ap(std::size_t i) const { return ap_[i]; }
+		const MobData::abilities_t& abilities(std::size_t i) const { return abilities_[i]; }
+		Coord c(std::size_t i) const { return c_[i]; }
+		int team(std::size_t i) const { return team_[i]; }
+	};
+
 	class Target
 	{
 	public:
 		Coord c;
-		Mob& mob;
+		Mob mob;
 
-		Target(const Coord& c, Mob& mob)
+		Target(const Coord& c, Mob mob)
 			: c(c),
 			  mob(mob) {}
 	};
 
-	enum class VertexState { Unvisited, Open, Closed };
-
+	// Result of a flood fill for a single hex, see Arena::path.
 	class Path
 	{
 	public:
 		boost::optional<Coord> source;
-		VertexState state;
-		int distance;
+		int distance = std::numeric_limits<int>::max();
+	};
+
+	// Shortest path tree of a flood fill, stored as separate arrays so that a
+	// search only touches what it needs: a byte with the direction to the parent,
+	// 16 bits of distance and a visited and an open (queued) bit per hex.
+	// Clearing the visited bits forgets the whole tree at once.
+	class PathTree
+	{
+		HexGrid<std::uint16_t> distances_;
+		HexGrid<std::uint8_t> parents_;
+		// Bit sets in the same order as the grids.
+		std::vector<std::uint64_t> visited_;
+		std::vector<std::uint64_t> open_;
+
+		std::size_t index(Coord c) const { return distances_.index(c); }
+
+		static bool test(const std::vector<std::uint64_t>& bits, std::size_t i) {
+			return (bits[i / 64] >> (i % 64)) & 1;
+		}
+
+		static void assign(std::vector<std::uint64_t>& bits, std::size_t i, bool value) {
+			auto mask = std::uint64_t(1) << (i % 64);
+			bits[i / 64] = value ? bits[i / 64] | mask : bits[i / 64] & ~mask;
+		}
+	public:
+		static constexpr int infinity = std::numeric_limits<int>::max();
+		// Paths that cost more than this can't be stored and count as unreachable.
+		static constexpr int max_distance = std::numeric_limits<std::uint16_t>::max();
+		static constexpr int no_parent = 6;
+
+		explicit PathTree(std::size_t size);
+
+		void clear();
+
+		bool visited(Coord c) const { return test(visited_, index(c)); }
+		bool is_open(Coord c) const { return test(open_, index(c)); }
+
+		int distance(Coord c) const {
+			return test(visited_, index(c)) ? distances_(c) : infinity;
+		}
+
+		// Index into hex_directions pointing from `c` to its parent, or no_parent.
+		int parent_direction(Coord c) const {
+			return test(visited_, index(c)) ? parents_(c) : no_parent;
+		}
+
+		boost::optional<Coord> parent(Coord c) const;
+
+		void set(Coord c, int distance, int parent_direction) {
+			assert(distance <= max_distance);
+			distances_(c) = static_cast<std::uint16_t>(distance);
+			parents_(c) = static_cast<std::uint8_t>(parent_direction);
+			assign(visited_, index(c), true);
+		}
+
+		void set_open(Coord c, bool open) { assign(open_, index(c), open); }
+
+		// Marks `c` as unreached again.
+		void reset(Coord c) {
+			assign(visited_, index(c), false);
+			assign(open_, index(c), false);
+		}
+
+		std::size_t memory() const;
+	};
+
+	struct Reachable
+	{
+		Coord c;
+		int cost;
+	};
+
+	// Hexes a mob can move to with its AP, filled in by Arena::reachable_cells.
+	// Sorted by cost, so the hexes reachable for at most k AP are a prefix.
+	class ReachableCells
+	{
+		std::vector<Reachable> cells_;
+		std::array<std::size_t, MAX_AP + 1> cost_end_;
+
+		friend class Arena;
+	public:
+		std::size_t size() const { return cells_.size(); }
+		bool empty() const { return cells_.empty(); }
+
+		const Reachable& operator[](std::size_t i) const { return cells_[i]; }
+		std::vector<Reachable>::const_iterator begin() const { return cells_.begin(); }
+		std::vector<Reachable>::const_iterator end() const { return cells_.end(); }
+
+		// Number of hexes reachable for at most `cost` AP.
+		std::size_t count_within(int cost) const {
+			if (cost < 0) return 0;
+			return cost_end_[std::min(cost, MAX_AP)];
+		}
+
+		// Uniformly random hex reachable for at most `max_cost` AP, must not be empty.
+		template <typename Generator>
+		const Reachable& sample(Generator& gen, int max_cost = MAX_AP) const {
+			std::size_t count = count_within(max_cost);
+			assert(count > 0);
+
+			std::uniform_int_distribution<std::size_t> dis(0, count - 1);
+			return cells_[dis(gen)];
+		}
 	};
 
 	class PlayerInfo
 	{
+		// Index into `mobs` of the living mob standing on each hex, or -1.
+		HexGrid<int> occupancy_;
+		unsigned occupancy_version_ = 0;
+		// Zobrist hash of the positions, hp and AP of the mobs.
+		std::uint64_t hash_ = 0;
 	public:
-		std::vector<Mob> mobs;
+		MobTable mobs;
 		std::vector<Team> teams;
 		std::size_t size;
 
 		PlayerInfo(std::size_t size);
 
-		Mob& add_mob(Mob mob);
-		Mob* mob_at(Coord c);
-		Index<Team> register_team(Player& player);
+		Mob add_mob(const MobData& mob);
+		boost::optional<Mob> mob_at(Coord c);
+		// None once the handle is stale.
+		boost::optional<Mob> mob(MobId id);
+		// Whether a living mob is standing on `c`.
+		bool occupied(Coord c) const;
+		// Index of the living mob standing on `c`, or -1.
+		int mob_index_at(Coord c) const;
+
+		// Mob positions, hp and AP have to go through these to keep `mob_at` and `hash` up to date.
+		void move_mob(Mob mob, Coord c);
+		void damage_mob(Mob mob, int d_hp);
+		// Sets the hp directly, bringing a dead mob back if it's positive, to take damage back.
+		void set_hp(Mob mob, int hp);
+		void set_ap(Mob mob, int ap);
+
+		// Debug check that the occupancy grid matches the positions of the living mobs.
+		bool check_occupancy() const;
+
+		// Bytes held outside of the object itself, by the teams and the occupancy grid.
+		std::size_t memory() const;
+
+		// Bumped whenever a mob is added, moves or dies.
+		unsigned occupancy_version() const { return occupancy_version_; }
+
+		// Part of GameState::hash for the mobs.
+		std::uint64_t hash() const { return hash_; }
+
+		// Returns the id of the new team, which its mobs are created with.
+		int register_team(Player& player);
 		Team& team_id(int id);
+		const Team& team_id(int id) const;
 
 		// Determine if a coord can be attacked, and if so, return the mob standing on it.
-		boost::optional<Target> can_attack(Mob& player, Coord c);
+		boost::optional<Target> can_attack(Mob player, Coord c);
 	};
 
 
+	// Monotone priority queue for Dial's algorithm. Entries are kept in a ring of
+	// buckets indexed by their key, which works as long as no key pushed is smaller
+	// than the last one popped, or more than `max_step` larger than the smallest
+	// one in the queue. Pushing and popping are both constant time, unlike a binary heap.
+	//
+	// A hex is queued at most once, lowering its key moves it to another bucket
+	// instead of adding a duplicate, so the queue never grows past the frontier.
+	class BucketQueue
+	{
+		std::vector<std::vector<Coord>> buckets_;
+		// Index of every queued hex in its bucket.
+		HexGrid<std::uint32_t> slots_;
+		std::size_t size_ = 0;
+		std::size_t peak_size_ = 0;
+		int current_ = 0;
+
+		std::vector<Coord>& bucket(int key) { return buckets_[key % buckets_.size()]; }
+		std::uint32_t& slot(Coord c) { return slots_(c); }
+	public:
+		// `size` is the size of the arena whose hexes are queued.
+		BucketQueue(int max_step, std::size_t size);
+
+		bool empty() const { return size_ == 0; }
+		std::size_t size() const { return size_; }
+		void clear();
+
+		void push(int key, Coord c);
+		// Moves `c`, which is queued with `old_key`, to the smaller `key`.
+		void decrease(int old_key, int key, Coord c);
+		int min_key() const;
+		Coord pop(int& key);
+
+		// Most hexes queued at once since the queue was created.
+		std::size_t peak_size() const { return peak_size_; }
+		std::size_t memory() const;
+	};
+
+	// View of a GameState: draws it and runs path searches over its hexes. An
+	// arena refers to the state it was created for, so it can't be copied, copy
+	// the GameState instead.
 	class Arena
 	{
+#ifndef HEXMAGE_HEADLESS
 		gl::Batch b;
 
 		gl::VAO vao;
 		gl::VBO vbo;
 
 		gl::Shader shader{ "vertex.glsl", "fragment.glsl" };
+#endif
+
+		GameState& state_;
+
+		bool flood_filled_ = false;
+		// Start of the last flood fill, needed to repair it in set_hex.
+		Coord start_;
+
+		bool is_blocked(Coord c, const PlayerInfo& info) const;
+		// Relaxes the neighbours of `current`, which has just been popped with `distance`.
+		void expand(Coord current, int distance, const PlayerInfo& info, PathTree& tree, BucketQueue& queue) const;
+		// Repair the last flood fill after `c` became a wall or more expensive
+		// to enter, or after it stopped being a wall or got cheaper.
+		void raise_cost(Coord c, PlayerInfo& info, std::vector<Coord>& changed);
+		void lower_cost(Coord c, PlayerInfo& info, std::vector<Coord>& changed);
+
+		// Scratch state for find_path, kept separate so that point queries
+		// don't clobber the flood fill in `paths`.
+		struct SearchNode
+		{
+			Coord source;
+			int cost = std::numeric_limits<int>::max();
+			bool closed = false;
+			unsigned generation = 0;
+		};
+
+		struct OpenNode
+		{
+			int cost;
+			Coord c;
+		};
+
+		HexGrid<SearchNode> search_;
+		std::vector<OpenNode> open_;
+		BucketQueue queue_;
+		unsigned search_generation_ = 0;
+
+		SearchNode& search_visit(Coord c);
 	public:
 
 		static constexpr float radius = 0.1f;
 		std::size_t size;
-		Matrix<HexType> hexes;
-		Matrix<Position> positions;
-		Matrix<Path> paths;
+		// The terrain of the state the arena shows.
+		HexGrid<HexType>& hexes;
+		// Movement cost of every hex, see MIN_MOVE_COST. Use set_move_cost to change it.
+		HexGrid<std::uint8_t>& move_costs;
+		HexGrid<Position> positions;
+		PathTree paths;
 		std::vector<float> vertices;
 
-		explicit Arena(std::size_t size);
+		// Needs a GL context unless built headless, `state` has to outlive the arena.
+		explicit Arena(GameState& state);
+		Arena(const Arena&) = delete;
+		Arena& operator=(const Arena&) = delete;
+
 		bool is_valid_coord(const Coord& c) const;
 		HexType& operator()(Coord c);
 		Position& pos(Coord c);
-		Coord hex_near(Position pos);
+		int move_cost(Coord c) const { return move_costs(c); }
 
+		// Hex whose center is closest to `pos`, found by inverting the grid layout
+		// instead of searching. Points outside of the arena pick the closest hex on its edge.
+		Coord hex_near(Position pos) const;
+		void hex_near(const std::vector<Position>& points, std::vector<Coord>& hexes) const;
+
+		// Reference version of hex_near that checks the distance to every hex.
+		Coord hex_near_exhaustive(Position pos) const;
+		Position hex_center(Coord c) const;
+
+		// Result of the last flood fill for `c`, cells it didn't reach
+		// have no source and an infinite distance.
+		Path path(Coord c) const;
+
+		// Cheapest movement cost from `start` to every hex, going around walls and mobs.
 		void dijkstra(Coord start, PlayerInfo& info);
+
+		// Same as dijkstra, but into buffers owned by the caller and without
+		// touching the arena, so that several can run at once.
+		void flood_fill(Coord start, const PlayerInfo& info, PathTree& tree, BucketQueue& queue) const;
+
+		// Makes `tree`, a flood fill from `start`, the current one as if dijkstra had computed it.
+		void use_paths(Coord start, const PathTree& tree);
+
+		// Bytes held by the flood fill, the `paths` grid and the queue, which
+		// only grows as large as the biggest frontier it has seen.
+		std::size_t path_memory() const;
+		std::size_t frontier_peak() const { return queue_.peak_size(); }
+
+		// Collects every hex `mob` can move to with its current AP from the last
+		// flood fill, which has to be the one started at `mob`.
+		void reachable_cells(const Mob& mob, ReachableCells& cells) const;
+
+		// Changes the type of a single hex and repairs the last flood fill in `paths`
+		// instead of recomputing it. Only the cells whose shortest path went through
+		// a new wall, or which got closer through a removed one, are touched, and
+		// those are appended to `changed`.
+		void set_hex(Coord c, HexType type, PlayerInfo& info, std::vector<Coord>& changed);
+
+		// Changes the movement cost of a hex, repairing `paths` the same way as set_hex.
+		void set_move_cost(Coord c, int cost, PlayerInfo& info, std::vector<Coord>& changed);
+
+		// Lets caches built from `hexes` notice that the walls or movement costs have changed.
+		unsigned terrain_version() const;
+
+		// A* search from `from` to `to` using hex_distance as the heuristic. Writes
+		// the steps after `from` up to and including `to` into `path`. Returns false
+		// if `to` can't be reached for at most `budget` AP. `to` itself may be
+		// occupied so that a path can lead up to a mob.
+		bool find_path(Coord from, Coord to, int budget, PlayerInfo& info, std::vector<Coord>& path);
+
+#ifndef HEXMAGE_HEADLESS
 		void regenerate_geometry(boost::optional<int> current_ap = boost::none);
 		void draw_vertices();
 
@@ -243,28 +809,7 @@ namespace model
 		void paint_hex(Position pos, float radius, Color color);
 		void paint_healthbar(glm::vec2 pos, float hp, float ap);
 		void paint_mob(TurnManager& turn_manager, PlayerInfo& info, const Mob& mob);
-	};
-
-	class Mob
-	{
-	public:
-		using abilities_t = std::vector<Ability>;
-		const int max_hp;
-		const int max_ap;
-
-		int hp;
-		int ap;
-
-		abilities_t abilities;
-		Coord c;
-		Index<Team> team;
-
-		Mob(int max_hp, int max_ap, abilities_t abilities, Index<Team> team);
-		bool use_ability(int index, Target target);
-		void move(GameInstance& arena, Coord d);
-
-		bool can_use_ability_at(Target t, PlayerInfo& info, Arena& arena, Ability ability);
-		abilities_t usable_abilities(Target t, PlayerInfo& info, Arena& arena);
+#endif
 	};
 
 	class Hex
@@ -276,26 +821,20 @@ namespace model
 	class Team
 	{
 		int number = -1;
-		Player& player_;
-		std::vector<Mob*> mobs_;
+		Player* player_;
 	public:
 		glm::vec3 color;
 
 		Team(int number, Player& player)
 			: number(number),
-			  player_(player)
+			  player_(&player)
 		{
-			using namespace std;
-			random_device rd;
-			mt19937 gen(rd());
-			uniform_real_distribution<float> dis(0.0f, 1.0f);
-
-			color = { dis(gen), dis(gen), dis(gen) };
+			auto& rng = thread_rng();
+			color = { rng.uniform(), rng.uniform(), rng.uniform() };
 		}
 
-		void add_mob(Mob& mob) { mobs_.push_back(&mob); }
 		inline int id() const { return number; }
-		inline Player& player() const { return player_; }
+		inline Player& player() const { return *player_; }
 	};
 
 	inline bool operator==(const Team& lhs, const Team& rhs) {
@@ -313,8 +852,8 @@ namespace model
 		virtual ~Player() = default;
 
 		virtual bool is_ai() const = 0;
-		virtual void action_to(Coord c, GameInstance& game, Mob& mob) = 0;
-		virtual void any_action(GameInstance& game, Mob& mob) = 0;
+		virtual void action_to(Coord c, GameInstance& game, Mob mob) = 0;
+		virtual void any_action(GameInstance& game, Mob mob) = 0;
 
 	};
 
@@ -322,53 +861,470 @@ namespace model
 	{
 	public:
 		bool is_ai() const override { return false; }
-		void action_to(Coord c, GameInstance& game, Mob& mob) override;
-		void any_action(GameInstance& game, Mob& mob) override;
+		void action_to(Coord c, GameInstance& game, Mob mob) override;
+		void any_action(GameInstance& game, Mob mob) override;
 	};
 
 	class AIPlayer : public Player
 	{
+		// Hexes the acting mob can move to, reused between actions.
+		ReachableCells reachable_;
+
 		bool is_ai() const override { return true; }
-		void action_to(Coord c, GameInstance& game, Mob& mob) override;
-		void any_action(GameInstance& game, Mob& mob) override;
+		void action_to(Coord c, GameInstance& game, Mob mob) override;
+		void any_action(GameInstance& game, Mob mob) override;
 	};
 
+	class ActionJournal;
+
+	// Order in which the mobs act during a turn, as handles into PlayerInfo::mobs.
 	class Turn
 	{
-		std::vector<Mob*> mobs_;
-	public:
-		std::vector<Mob*>::iterator current_;
+		std::vector<MobId> order_;
+		std::size_t current_ = 0;
+		// Zobrist keys of the order, the cursor is mixed in by hash().
+		std::uint64_t order_hash_ = 0;
+
+		void rehash_order();
 
+		friend class ActionJournal;
+	public:
 		Turn() = default;
-		explicit Turn(std::vector<Mob>& mobs);
+		explicit Turn(const MobTable& mobs);
+
+		// Starts over with the mobs ordered by their AP, reusing the buffer.
+		void reset(const MobTable& mobs);
+
+		bool is_done() const { return current_ >= order_.size(); }
+		// The mob that is acting, the turn must not be done.
+		MobId current() const;
+		// Moves on to the next living mob and returns it, or none once everyone had their turn.
+		MobId next(const PlayerInfo& info);
+		// Whether no living mob is left to act after the current one.
+		bool is_last(const PlayerInfo& info) const;
+
+		const std::vector<MobId>& order() const { return order_; }
+		// How far the turn has got, in order().
+		std::size_t cursor() const { return current_; }
+
+		// Part of GameState::hash for the order and the cursor.
+		std::uint64_t hash() const {
+			return order_hash_ ^ zobrist_key(ZobristFeature::TurnCursor, static_cast<std::uint32_t>(current_), 0u);
+		}
+	};
 
-		bool is_done() const { return current_ == mobs_.end(); }
-		Mob* next();
+	enum class ActionType
+	{
+		Move,
+		UseAbility,
+		EndTurn
 	};
 
-	class GameInstance
+	// Something a mob can do. Moves only go to a neighbouring hex, a longer
+	// walk is a sequence of them.
+	struct Action
 	{
+		ActionType type;
+		MobId mob;
+		// Where to move, or the hex the ability is used at.
+		Coord c;
+		// Index into the abilities of the mob, only for UseAbility.
+		int ability;
+
+		static Action move(MobId mob, Coord c) { return{ ActionType::Move, mob, c, -1 }; }
+		static Action use_ability(MobId mob, int ability, Coord c) { return{ ActionType::UseAbility, mob, c, ability }; }
+		static Action end_turn() { return{ ActionType::EndTurn, MobId(), Coord(), -1 }; }
+	};
+
+	// Everything the rules of a game depend on: the terrain, the mobs with their
+	// teams and the turn order, but nothing about how it's drawn, so it doesn't
+	// need a GL context. Nothing in it points into itself, mobs refer to their
+	// team by index and the turn to its mobs by handle, so a state can be copied or moved
+	// around freely, which is what searching through possible moves needs.
+	class GameState
+	{
+		// Bumped whenever a wall is added or removed or a movement cost changes.
+		unsigned terrain_version_ = 0;
+		// Zobrist hash of the walls and the hexes that aren't MIN_MOVE_COST.
+		std::uint64_t terrain_hash_ = 0;
 	public:
-		Arena arena;
-		PlayerInfo info;
 		std::size_t size;
+		HexGrid<HexType> hexes;
+		// Movement cost of every hex, see MIN_MOVE_COST.
+		HexGrid<std::uint8_t> move_costs;
+		PlayerInfo info;
+		Turn turn;
+
+		explicit GameState(std::size_t size);
+
+		bool is_valid_coord(Coord c) const;
+		int move_cost(Coord c) const { return move_costs(c); }
+
+		// Changes a hex without repairing any flood fill, see Arena::set_hex for that.
+		// Writing to `hexes` or `move_costs` directly leaves hash() behind.
+		void set_hex(Coord c, HexType type);
+		void set_move_cost(Coord c, int cost);
+
+		// Lets caches built from `hexes` notice that the walls or movement costs have changed.
+		unsigned terrain_version() const { return terrain_version_; }
+
+		// Refills the AP of every mob and orders them for a new turn.
+		void start_turn();
+
+		// Whether the rules allow the action. Abilities need a line of sight
+		// to their target, like in Mob::can_use_ability_at.
+		bool is_legal(const Action& action) const;
+		// Carries out a legal action. Ending the turn of the last mob starts a new turn.
+		void apply(const Action& action);
+		// Replaces `actions` with every legal action of the current mob, ending
+		// its turn is always one of them.
+		void legal_actions(std::vector<Action>& actions) const;
+		// Id of the only team that still has living mobs, or -1 while the game goes on.
+		int winning_team() const;
+
+		// Zobrist hash of the walls, terrain costs, mobs and the turn, kept up to
+		// date by every change made through the state, PlayerInfo and the actions.
+		// Equal states have equal hashes, whatever happened to get there, so it
+		// can key transposition tables and caches of anything derived from the state.
+		std::uint64_t hash() const { return terrain_hash_ ^ info.hash() ^ turn.hash(); }
+		// The same hash computed from scratch, to check the incremental one.
+		std::uint64_t compute_hash() const;
+
+		// Bytes held by the state, all of which a copy has to duplicate.
+		std::size_t memory() const;
+	};
+
+	// Applies actions to a GameState and remembers just enough about each one
+	// to take it back, which lets a search walk through possible moves on a
+	// single state instead of copying it. Undo has to go in the opposite order
+	// to apply, on the same state. Entries are kept in buffers reserved up
+	// front and reused after undo, so applying doesn't allocate.
+	class ActionJournal
+	{
+		struct Entry
+		{
+			Action action;
+			// The acting mob before the action.
+			int ap;
+			Coord c;
+			// The mob hit by an ability and its hp before, or -1.
+			int target;
+			int target_hp;
+			std::size_t cursor;
+			// Whether ending the turn started a new one, the previous order and
+			// AP are then on top of `saved_order_` and `saved_ap_`.
+			bool new_turn;
+			std::size_t order_size;
+		};
+
+		std::vector<Entry> entries_;
+		std::vector<MobId> saved_order_;
+		std::vector<int> saved_ap_;
+	public:
+		// Room for `capacity` actions on a state with `mob_count` mobs. Each of
+		// them could end a turn, which saves the AP and the order of every mob,
+		// so the buffers are reserved for that and applying never allocates.
+		explicit ActionJournal(std::size_t capacity, std::size_t mob_count = MAX_MOBS);
+
+		void apply(GameState& state, const Action& action);
+		// Takes back the last action that is still applied.
+		void undo(GameState& state);
+
+		std::size_t size() const { return entries_.size(); }
+		bool empty() const { return entries_.empty(); }
+		// Forgets every entry without undoing anything.
+		void clear();
+	};
+
+	// Cheapest movement cost between any two hexes, going around walls but not
+	// mobs. Mobs can only make a path longer, so it's a lower bound on what a
+	// move really costs. Arenas of up to `max_precomputed_cells` hexes get an all
+	// pairs table that is rebuilt on the shared worker pool the first time it's
+	// queried after the terrain changed. Larger arenas fall back to a flood fill
+	// from the queried source, which is cached until the source or the terrain change.
+	class DistanceOracle
+	{
+		const Arena& arena_;
+		std::size_t cells_;
+		unsigned terrain_version_ = 0;
+		bool built_ = false;
+
+		// Only one of the tables is used, depending on the most expensive possible path.
+		std::vector<std::uint8_t> table8_;
+		std::vector<std::uint16_t> table16_;
+
+		HexGrid<int> row_;
+		BucketQueue queue_;
+		Coord row_source_;
+
+		bool narrow() const { return cells_ * MAX_MOVE_COST < std::numeric_limits<std::uint8_t>::max(); }
+
+		void update();
+		void fill_row(Coord source, HexGrid<int>& distances, BucketQueue& queue) const;
+
+		template <typename T>
+		void build_table(std::vector<T>& table);
+	public:
+		static constexpr std::size_t max_precomputed_cells = 2048;
+
+		explicit DistanceOracle(const Arena& arena);
+
+		bool precomputed() const { return cells_ <= max_precomputed_cells; }
+
+		// AP it takes to get from `from` to `to`, or the maximum int if there is no way through.
+		int distance(Coord from, Coord to);
+	};
+
+	// Whether the line between two hexes up to MAX_ABILITY_RANGE apart misses
+	// every wall, mobs don't block it. The hexes each line passes through are
+	// precomputed per offset, so a test only looks at the few hexes on the line
+	// and needs no cache of its own. False for anything further away.
+	bool line_of_sight(const HexGrid<HexType>& hexes, Coord from, Coord to);
+
+	struct FieldSeed
+	{
+		Coord c;
+		int id;
+	};
+
+	// AP it takes to walk from every hex to the closest of a set of seed hexes,
+	// along with the id of that seed, computed by a single search from all of
+	// them at once that pays the movement costs like Arena::flood_fill. Walls
+	// block the search. Hexes with other mobs on them get a distance but aren't
+	// expanded, so mobs can find their own distance to a seed.
+	class DistanceField
+	{
+		HexGrid<int> distance_;
+		HexGrid<int> nearest_;
+		BucketQueue queue_;
+	public:
+		// Versions of the arena and mobs the field was computed for.
+		unsigned terrain_version = 0;
+		unsigned occupancy_version = 0;
+		bool computed = false;
+
+		explicit DistanceField(std::size_t size);
+
+		void compute(const Arena& arena, const PlayerInfo& info, const std::vector<FieldSeed>& seeds);
 
-		GameInstance(std::size_t size) : arena(size), info(size), size(size) {}
+		// Maximum int for hexes none of the seeds can reach.
+		int distance(Coord c) const { return distance_(c); }
+		// Id of the closest seed, -1 for unreachable hexes.
+		int nearest(Coord c) const { return nearest_(c); }
+	};
+
+	// A flood fill for every mob, computed for all living mobs at once on the
+	// shared worker pool when a turn starts, each into its own buffers. A fill
+	// is only valid until a mob moves or the terrain changes, after that a
+	// lookup redoes just the fill it asked for, so answering one query never
+	// costs a flood fill per mob.
+	class MobPaths
+	{
+		struct Entry
+		{
+			PathTree tree;
+			BucketQueue queue;
+			Coord start;
+			unsigned terrain_version = 0;
+			unsigned occupancy_version = 0;
+			bool valid = false;
+
+			explicit Entry(std::size_t size) : tree(size), queue(MAX_MOVE_COST + MIN_MOVE_COST, size) {}
+		};
+
+		std::vector<Entry> entries_;
+
+		bool is_current(const Entry& entry, Coord start, const Arena& arena, const PlayerInfo& info) const;
+		void fill(Entry& entry, Coord start, const Arena& arena, const PlayerInfo& info);
+	public:
+		void compute(const Arena& arena, const PlayerInfo& info);
 
-		Turn start_turn();
+		// Flood fill from `mob`, which has to be one of `info.mobs`.
+		const PathTree& of(const Mob& mob, const Arena& arena, const PlayerInfo& info);
+	};
+
+	// Hierarchical pathfinding for arenas too large to search hex by hex. The
+	// arena is cut into square clusters, and every run of open hexes along the
+	// border of two clusters gets a few entrances. Entrances are connected to
+	// the ones on the other side of the border and to the other entrances of
+	// their cluster by the cheapest path that stays inside it. A query searches
+	// this much smaller graph, then fills in the hexes only between the
+	// waypoints it actually needs.
+	//
+	// Paths go around walls and pay the movement costs, but ignore mobs like
+	// DistanceOracle does. They can be slightly longer than the cheapest ones,
+	// since they have to pass through the entrances.
+	//
+	// Editing a hex only rebuilds its own cluster, and the neighbouring ones
+	// if the hex is on a border, see invalidate. Rebuilds run on the shared
+	// WorkerPool, so queries can't be made from inside one of its jobs.
+	class ClusterPaths
+	{
+	public:
+		static constexpr int cluster_size = 16;
+		// Longest run of border hexes covered by a single entrance.
+		static constexpr int entrance_width = 6;
+		// Every entrance is a distinct border hex of its cluster.
+		static constexpr int max_entrances = 4 * cluster_size;
+
+	private:
+		struct Link
+		{
+			// Entrance of this cluster and the one it steps to in `cluster`.
+			int from;
+			int cluster;
+			Coord to;
+			int cost;
+			// Search node of `to`, resolved once both clusters are rebuilt.
+			int node = -1;
+		};
+
+		struct Cluster
+		{
+			std::vector<Coord> entrances;
+			// Cheapest cost between two entrances without leaving the cluster,
+			// one row per starting entrance.
+			std::vector<int> costs;
+			std::vector<Link> links;
+			bool dirty = false;
+		};
+
+		// Dijkstra over the hexes of a single cluster. A step costs at most
+		// MAX_MOVE_COST, so like in BucketQueue, that many buckets plus one are
+		// enough to keep every queued hex apart.
+		struct LocalSearch
+		{
+			std::array<int, cluster_size * cluster_size> cost;
+			std::array<std::uint8_t, cluster_size * cluster_size> parent;
+			std::array<std::vector<int>, MAX_MOVE_COST + 1> buckets;
+		};
+
+		struct SearchNode
+		{
+			int cost;
+			int parent;
+			unsigned generation = 0;
+		};
+
+		struct OpenNode
+		{
+			int estimate;
+			int cost;
+			int node;
+
+			// Among equal estimates the node furthest along goes first, which
+			// keeps the search from spreading over routes that are all as good.
+			bool operator>(const OpenNode& rhs) const {
+				return estimate > rhs.estimate || (estimate == rhs.estimate && cost < rhs.cost);
+			}
+		};
+
+		const Arena& arena_;
+		int width_;
+		unsigned terrain_version_ = 0;
+		bool built_ = false;
+
+		std::vector<Cluster> clusters_;
+		std::vector<int> dirty_;
+
+		// Entrances are numbered max_entrances per cluster, the goal comes after all of them.
+		std::vector<SearchNode> search_;
+		std::vector<OpenNode> open_;
+		std::vector<int> goal_costs_;
+		LocalSearch local_;
+		unsigned generation_ = 0;
+		int cost_ = 0;
+		std::vector<Coord> waypoints_;
+
+		int cluster_of(Coord c) const { return (c.y / cluster_size) * width_ + c.x / cluster_size; }
+		Coord origin(int cluster) const;
+		int entrance_index(int cluster, Coord c) const;
+
+		void update();
+		void mark_dirty(int cluster);
+		void rebuild(int cluster, LocalSearch& search);
+		void resolve_links(int cluster);
+		// Entrances on the border between clusters `a` and `b`, as pairs of
+		// neighbouring hexes from `a` and `b`. Both clusters get the same ones.
+		void border(int a, int b, std::vector<std::pair<Coord, Coord>>& entrances) const;
+		// Costs from `source` to the hexes of its cluster, or from them to `source` when `reverse` is set.
+		void search_cluster(Coord source, bool reverse, LocalSearch& search, Coord stop = { -1, -1 }) const;
+
+		SearchNode& visit(int node);
+		void relax(int node, Coord c, int cost, int parent, Coord to);
+	public:
+		explicit ClusterPaths(const Arena& arena);
+
+		// Has to be called after the type or the movement cost of `c` changed,
+		// once per edit. Edits made without it are only noticed through the
+		// terrain version, which rebuilds every cluster at the next query.
+		void invalidate(Coord c);
+
+		// Cheapest route from `from` to `to` through the entrances, starting with
+		// `from` and ending with `to`. Consecutive waypoints are either neighbours
+		// or in the same cluster. Returns false if `to` can't be reached.
+		bool plan(Coord from, Coord to, std::vector<Coord>& waypoints);
+		// Cost of the last route found by plan.
+		int cost() const { return cost_; }
+
+		// Appends the hexes after `from` up to and including `to`, which are
+		// consecutive waypoints of a route.
+		void refine(Coord from, Coord to, std::vector<Coord>& path);
+
+		// Plans a route and refines it waypoint by waypoint until `path` has at
+		// least `max_steps` hexes, like Arena::find_path without a budget.
+		bool find_path(Coord from, Coord to, std::vector<Coord>& path,
+		               std::size_t max_steps = std::numeric_limits<std::size_t>::max());
+
+		std::size_t entrance_count() const;
+		std::size_t memory() const;
+	};
+
+	// A game being played: the state plus the arena and caches built on it.
+	// Everything except `state` points into the instance itself, so it can't be
+	// copied, searches copy `state` and work on the GameState alone.
+	class GameInstance
+	{
+		std::vector<DistanceField> enemy_fields_;
+		std::vector<FieldSeed> seeds_;
+	public:
+		GameState state;
+		// Renders `state`, and keeps the flood fill of the current mob around.
+		Arena arena;
+		PlayerInfo& info;
+		std::size_t size;
+		DistanceOracle distances;
+		MobPaths mob_paths;
+		ClusterPaths clusters;
+
+		GameInstance(std::size_t size)
+			: state(size), arena(state), info(state.info), size(size), distances(arena), clusters(arena) {}
+		GameInstance(const GameInstance&) = delete;
+		GameInstance& operator=(const GameInstance&) = delete;
+
+		// Distance field seeded by every living mob that isn't on `team`, with the
+		// index into `info.mobs` as the seed id. Shared by all mobs of the team and
+		// only recomputed once mobs or walls have changed.
+		const DistanceField& enemy_field(const Team& team);
+
+		// Refills the AP of every mob and starts a new turn in `state.turn`.
+		Turn& start_turn();
 	};
 
 	class TurnManager
 	{
 		PlayerInfo& info_;
 	public:
-		Turn current_turn;
+		// Turn order of the state being played.
+		Turn& current_turn;
 
-		explicit TurnManager(PlayerInfo& info):
-			info_(info) {}
+		explicit TurnManager(GameState& state):
+			info_(state.info), current_turn(state.turn) {}
 
 		void update_arena(Arena& arena);
-		Mob* current_mob() const;
+		boost::optional<Mob> current_mob() const;
+		// Moves on to the next living mob, none once the turn is done.
+		boost::optional<Mob> next_mob();
 		// TODO 
 	};
 }
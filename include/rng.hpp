@@ -0,0 +1,101 @@
+#ifndef RNG_HPP
+#define RNG_HPP
+
+#pragma once
+
+#include <cstdint>
+#include <limits>
+
+namespace model
+{
+	// The splitmix64 finalizer. It's a bijection that spreads every input bit
+	// over the whole output, which makes it good for turning seeds, ids and
+	// features into unrelated 64 bit values.
+	inline std::uint64_t mix64(std::uint64_t z) {
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+
+	// xoshiro256** random numbers, a few cycles per call and 32 bytes of
+	// state, so every thread, game or search can own its generator. A generator
+	// is identified by a seed and a stream: the same pair always gives the same
+	// numbers, and different streams of one seed don't overlap in practice, so
+	// a whole run can be derived from a single master seed, for example with a
+	// stream per game. Works with the std distributions, but the helpers below
+	// are cheaper and give the same results on every standard library.
+	class Rng
+	{
+		std::uint64_t s_[4];
+
+		static std::uint64_t rotl(std::uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+	public:
+		using result_type = std::uint64_t;
+
+		explicit Rng(std::uint64_t seed = 0, std::uint64_t stream = 0) {
+			// Fill the state from a splitmix64 sequence, which never leaves it all zero.
+			std::uint64_t z = mix64(seed ^ mix64(stream + 0x9e3779b97f4a7c15ull));
+			for (auto& s : s_) {
+				z += 0x9e3779b97f4a7c15ull;
+				s = mix64(z);
+			}
+		}
+
+		// Independent generator for `stream`, seeded from the current state of
+		// this one without advancing it.
+		Rng split(std::uint64_t stream) const { return Rng(s_[0] ^ rotl(s_[2], 32), stream); }
+
+		static constexpr result_type min() { return 0; }
+		static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+		result_type operator()() {
+			std::uint64_t result = rotl(s_[1] * 5, 7) * 9;
+			std::uint64_t t = s_[1] << 17;
+
+			s_[2] ^= s_[0];
+			s_[3] ^= s_[1];
+			s_[1] ^= s_[2];
+			s_[0] ^= s_[3];
+			s_[2] ^= t;
+			s_[3] = rotl(s_[3], 45);
+
+			return result;
+		}
+
+		// Uniform in [0, n), n > 0. Lemire's multiply and shift on the top 32
+		// bits, with the rejection that removes its bias, so there's no division
+		// in the common case.
+		std::uint32_t below(std::uint32_t n) {
+			std::uint64_t m = ((*this)() >> 32) * n;
+
+			if (static_cast<std::uint32_t>(m) < n) {
+				std::uint32_t threshold = (0u - n) % n;
+				while (static_cast<std::uint32_t>(m) < threshold) {
+					m = ((*this)() >> 32) * n;
+				}
+			}
+
+			return static_cast<std::uint32_t>(m >> 32);
+		}
+
+		// Uniform in [lo, hi], inclusive like std::uniform_int_distribution.
+		int range(int lo, int hi) {
+			return lo + static_cast<int>(below(static_cast<std::uint32_t>(hi - lo) + 1));
+		}
+
+		// Uniform in [0, 1).
+		float uniform() { return ((*this)() >> 40) * (1.0f / (1 << 24)); }
+	};
+
+	// Seed everything without a generator of its own is derived from, 0 unless
+	// set. Setting it only affects generators created afterwards.
+	std::uint64_t master_seed();
+	void set_master_seed(std::uint64_t seed);
+
+	// Generator of the calling thread, a stream of the master seed numbered by
+	// the order in which threads first asked for one. For incidental numbers,
+	// anything that has to be reproducible across threads takes its own Rng.
+	Rng& thread_rng();
+}
+
+#endif
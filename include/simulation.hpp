@@ -3,10 +3,13 @@
 
 #pragma once
 
+#include <array>
+#include <cstdint>
 #include <vector>
 #include <random>
 #include <model.hpp>
 #include <stopwatch.hpp>
+#include <worker_pool.hpp>
 #include <generator.hpp>
 #include <format.h>
 
@@ -17,10 +20,93 @@ namespace simulation
 
 	constexpr int ABILITY_COUNT = 6;
 
+	// Counts of values in buckets by powers of two, bucket b holding the values
+	// that take b bits, so zero is alone in the first one.
+	struct Histogram
+	{
+		std::array<std::size_t, 65> buckets{};
+
+		void add(std::uint64_t value);
+		void merge(const Histogram& other);
+
+		std::size_t count() const;
+		// Upper bound of the bucket containing the value `fraction` of the way
+		// through the sorted values, so 0.5 gives a bound on the median.
+		std::uint64_t percentile(float fraction) const;
+	};
+
+	// Totals over a batch of playouts.
+	struct PlayoutStats
+	{
+		std::size_t playouts = 0;
+		std::size_t turns = 0;
+		std::size_t actions = 0;
+		// Games that hit the turn limit before a team was wiped out.
+		std::size_t draws = 0;
+		// Games won, by team id.
+		std::vector<std::size_t> wins;
+		// Turns and microseconds taken by each game.
+		Histogram lengths;
+		Histogram game_us;
+		float ms = 0;
+
+		// Adds the games of `other`, but not its time, which may have overlapped.
+		void merge(const PlayoutStats& other);
+	};
+
+	// Random playouts of a small game: every mob takes random legal actions,
+	// ending its turn among them, until only one team has living mobs left.
+	// Each playout starts over from the same randomly generated position. The
+	// state, the action list and the generator are reused from game to game, so
+	// a playout doesn't allocate.
 	class DummySimulation
 	{
+		model::GameState initial_;
+		model::GameState state_;
+		std::vector<model::Action> actions_;
+		model::Rng gen_;
 	public:
-		void run();
+		// Games still going after this many turns count as a draw.
+		int max_turns = 1000;
+
+		// Generates the starting position and plays from the same `seed`.
+		DummySimulation(std::size_t size = 10, int mobs_per_team = 5, std::uint64_t seed = model::master_seed());
+		// Plays from `initial`, which has to be at the start of a turn.
+		explicit DummySimulation(const model::GameState& initial, std::uint64_t seed = 0);
+
+		// Two teams of `mobs_per_team` random mobs on an empty arena, at the start of the first turn.
+		static model::GameState starting_position(std::size_t size, int mobs_per_team, model::Rng rng);
+
+		// Restarts the random actions from a stream, the same seed and stream play the same games.
+		void seed(std::uint64_t seed, std::uint64_t stream = 0);
+
+		// Plays one game to the end and adds it to `stats`. Returns the winning
+		// team, or -1 for a draw.
+		int playout(PlayoutStats& stats);
+
+		// Plays `playouts` games and prints how fast they went.
+		PlayoutStats run(std::size_t playouts = 100000);
+	};
+
+	// Plays a large number of independent games from the same position on a
+	// WorkerPool. The games are split into a shard for every thread, and each
+	// shard gets its own DummySimulation and stats, which are only merged once
+	// the whole batch is done, so workers never share anything while playing.
+	// Game n plays with stream n of the master seed, so a run gives the same
+	// results for any number of threads.
+	class PlayoutFarm
+	{
+		model::GameState initial_;
+		std::uint64_t master_seed_;
+		model::WorkerPool& pool_;
+		std::vector<DummySimulation> shards_;
+	public:
+		PlayoutFarm(const model::GameState& initial, std::uint64_t master_seed,
+		            model::WorkerPool& pool = model::WorkerPool::shared());
+
+		// Plays `games` games, prints a summary and returns the merged stats,
+		// timed by the wall clock.
+		PlayoutStats run(std::size_t games);
 	};
 
 }
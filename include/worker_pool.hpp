@@ -0,0 +1,55 @@
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace model
+{
+	// A fixed set of threads that run batches of independent jobs, numbered
+	// from 0. The calling thread works on the batch too, and run() only returns
+	// once every job is done. Keeping the threads around makes batches cheap
+	// enough to start a few times per turn.
+	class WorkerPool
+	{
+		std::vector<std::thread> threads_;
+		std::mutex mutex_;
+		std::condition_variable work_ready_;
+		std::condition_variable work_done_;
+
+		const std::function<void(std::size_t)>* job_ = nullptr;
+		std::size_t job_count_ = 0;
+		std::atomic<std::size_t> next_job_{ 0 };
+		// Workers that haven't finished the current batch yet.
+		std::size_t busy_ = 0;
+		unsigned batch_ = 0;
+		bool stopping_ = false;
+
+		void work();
+		void drain();
+	public:
+		// Uses every core by default, counting the calling thread.
+		explicit WorkerPool(std::size_t threads = std::thread::hardware_concurrency());
+		~WorkerPool();
+
+		WorkerPool(const WorkerPool&) = delete;
+		WorkerPool& operator=(const WorkerPool&) = delete;
+
+		std::size_t thread_count() const { return threads_.size() + 1; }
+
+		// Not reentrant, jobs must not call run() on the pool they run on, or
+		// anything that does, like the caches using shared().
+		void run(std::size_t jobs, const std::function<void(std::size_t)>& job);
+
+		// Pool shared by everything that doesn't need its own.
+		static WorkerPool& shared();
+	};
+}
+
+#endif
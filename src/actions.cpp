@@ -0,0 +1,198 @@
+#include <model.hpp>
+
+namespace model
+{
+	bool GameState::is_legal(const Action& action) const {
+		if (action.type == ActionType::EndTurn) return true;
+
+		// Only the mob whose turn it is gets to act, and only while it's alive.
+		if (turn.is_done() || turn.current() != action.mob || !info.mobs.contains(action.mob)) return false;
+
+		std::size_t i = action.mob.index;
+		if (info.mobs.hp(i) <= 0) return false;
+
+		int ap = info.mobs.ap(i);
+		Coord from = info.mobs.c(i);
+
+		switch (action.type) {
+		case ActionType::Move:
+			return hex_distance(from, action.c) == 1 &&
+				is_valid_coord(action.c) &&
+				hexes(action.c) != HexType::Wall &&
+				!info.occupied(action.c) &&
+				move_cost(action.c) <= ap;
+
+		case ActionType::UseAbility: {
+			if (action.ability < 0 || action.ability >= ABILITY_COUNT) return false;
+
+			auto& ability = info.mobs.abilities(i)[action.ability];
+			int target = info.mob_index_at(action.c);
+
+			return ability.cost <= ap &&
+				hex_distance(from, action.c) <= ability.range &&
+				target >= 0 &&
+				info.mobs.team(target) != info.mobs.team(i) &&
+				line_of_sight(hexes, from, action.c);
+		}
+
+		default:
+			return false;
+		}
+	}
+
+	void GameState::apply(const Action& action) {
+		switch (action.type) {
+		case ActionType::Move: {
+			auto mob = info.mobs[action.mob];
+			info.set_ap(mob, mob.ap - move_cost(action.c));
+			info.move_mob(mob, action.c);
+			break;
+		}
+
+		case ActionType::UseAbility: {
+			auto mob = info.mobs[action.mob];
+			auto& ability = mob.abilities[action.ability];
+			auto target = info.mob_at(action.c);
+			assert(target);
+
+			info.set_ap(mob, mob.ap - ability.cost);
+			info.damage_mob(*target, ability.d_hp);
+			break;
+		}
+
+		case ActionType::EndTurn:
+			if (turn.next(info).is_none()) {
+				start_turn();
+			}
+			break;
+		}
+	}
+
+	void GameState::legal_actions(std::vector<Action>& actions) const {
+		actions.clear();
+		actions.push_back(Action::end_turn());
+
+		if (turn.is_done()) return;
+
+		auto id = turn.current();
+		if (!info.mobs.contains(id) || info.mobs.hp(id.index) <= 0) return;
+
+		Coord from = info.mobs.c(id.index);
+		for (auto d : hex_directions) {
+			auto action = Action::move(id, from + d);
+			if (is_legal(action)) {
+				actions.push_back(action);
+			}
+		}
+
+		for (std::size_t target = 0; target < info.mobs.size(); ++target) {
+			if (info.mobs.hp(target) <= 0) continue;
+
+			for (int ability = 0; ability < ABILITY_COUNT; ++ability) {
+				auto action = Action::use_ability(id, ability, info.mobs.c(target));
+				if (is_legal(action)) {
+					actions.push_back(action);
+				}
+			}
+		}
+	}
+
+	int GameState::winning_team() const {
+		int winner = -1;
+
+		for (std::size_t i = 0; i < info.mobs.size(); ++i) {
+			if (info.mobs.hp(i) <= 0) continue;
+
+			if (winner < 0) {
+				winner = info.mobs.team(i);
+			} else if (winner != info.mobs.team(i)) {
+				return -1;
+			}
+		}
+
+		return winner;
+	}
+
+	ActionJournal::ActionJournal(std::size_t capacity, std::size_t mob_count) {
+		entries_.reserve(capacity);
+		saved_order_.reserve(capacity * mob_count);
+		saved_ap_.reserve(capacity * mob_count);
+	}
+
+	void ActionJournal::apply(GameState& state, const Action& action) {
+		auto& mobs = state.info.mobs;
+		Entry entry{ action, 0, Coord(), -1, 0, state.turn.cursor(), false, state.turn.order_.size() };
+
+		if (action.type == ActionType::EndTurn) {
+			// A new turn rewrites the AP of every mob and the whole order.
+			if (state.turn.is_last(state.info)) {
+				entry.new_turn = true;
+				saved_order_.insert(saved_order_.end(), state.turn.order_.begin(), state.turn.order_.end());
+				for (std::size_t i = 0; i < mobs.size(); ++i) {
+					saved_ap_.push_back(mobs.ap(i));
+				}
+			}
+		} else {
+			std::size_t i = action.mob.index;
+			entry.ap = mobs.ap(i);
+			entry.c = mobs.c(i);
+
+			if (action.type == ActionType::UseAbility) {
+				entry.target = state.info.mob_index_at(action.c);
+				assert(entry.target >= 0);
+				entry.target_hp = mobs.hp(entry.target);
+			}
+		}
+
+		entries_.push_back(entry);
+		state.apply(action);
+	}
+
+	void ActionJournal::undo(GameState& state) {
+		assert(!entries_.empty());
+		auto entry = entries_.back();
+		entries_.pop_back();
+
+		auto& info = state.info;
+
+		switch (entry.action.type) {
+		case ActionType::Move: {
+			auto mob = info.mobs[entry.action.mob];
+			info.move_mob(mob, entry.c);
+			info.set_ap(mob, entry.ap);
+			break;
+		}
+
+		case ActionType::UseAbility:
+			info.set_ap(info.mobs[entry.action.mob], entry.ap);
+			info.set_hp(info.mobs[entry.target], entry.target_hp);
+			break;
+
+		case ActionType::EndTurn:
+			if (entry.new_turn) {
+				std::size_t count = info.mobs.size();
+				assert(saved_ap_.size() >= count && saved_order_.size() >= entry.order_size);
+
+				auto ap = saved_ap_.end() - count;
+				for (std::size_t i = 0; i < count; ++i) {
+					info.set_ap(info.mobs[i], ap[i]);
+				}
+				saved_ap_.erase(ap, saved_ap_.end());
+
+				auto order = saved_order_.end() - entry.order_size;
+				state.turn.order_.assign(order, saved_order_.end());
+				state.turn.rehash_order();
+				saved_order_.erase(order, saved_order_.end());
+			}
+			break;
+		}
+
+		state.turn.current_ = entry.cursor;
+	}
+
+	void ActionJournal::clear() {
+		entries_.clear();
+		saved_order_.clear();
+		saved_ap_.clear();
+	}
+}
@@ -0,0 +1,430 @@
+#include <functional>
+#include <model.hpp>
+#include <worker_pool.hpp>
+
+namespace model
+{
+	namespace
+	{
+		constexpr int K = ClusterPaths::cluster_size;
+
+		int local_index(Coord c, Coord origin) {
+			return (c.y - origin.y) * K + c.x - origin.x;
+		}
+	}
+
+	ClusterPaths::ClusterPaths(const Arena& arena)
+		: arena_(arena), width_(static_cast<int>((arena.size + K - 1) / K)) {
+		clusters_.resize(width_ * width_);
+		search_.resize(clusters_.size() * max_entrances + 1);
+	}
+
+	Coord ClusterPaths::origin(int cluster) const {
+		return{ (cluster % width_) * K, (cluster / width_) * K };
+	}
+
+	int ClusterPaths::entrance_index(int cluster, Coord c) const {
+		auto& entrances = clusters_[cluster].entrances;
+		auto it = std::find(entrances.begin(), entrances.end(), c);
+		return it == entrances.end() ? -1 : static_cast<int>(it - entrances.begin());
+	}
+
+	void ClusterPaths::mark_dirty(int cluster) {
+		if (!clusters_[cluster].dirty) {
+			clusters_[cluster].dirty = true;
+			dirty_.push_back(cluster);
+		}
+	}
+
+	void ClusterPaths::invalidate(Coord c) {
+		assert(arena_.is_valid_coord(c));
+		// Nothing is built yet, the first query builds everything anyway.
+		if (!built_) return;
+
+		// Entrances only depend on hexes next to a border, so besides its own
+		// cluster, only the ones of its neighbours across a border can change.
+		mark_dirty(cluster_of(c));
+		for (auto diff : hex_directions) {
+			auto neighbour = c + diff;
+			if (arena_.is_valid_coord(neighbour)) {
+				mark_dirty(cluster_of(neighbour));
+			}
+		}
+
+		// Only skip the full rebuild when this edit is the single one since the
+		// last update, other edits bumped the version without invalidating.
+		if (terrain_version_ + 1 == arena_.terrain_version()) {
+			terrain_version_ = arena_.terrain_version();
+		}
+	}
+
+	void ClusterPaths::update() {
+		if (!built_ || terrain_version_ != arena_.terrain_version()) {
+			for (std::size_t i = 0; i < clusters_.size(); ++i) {
+				mark_dirty(static_cast<int>(i));
+			}
+
+			terrain_version_ = arena_.terrain_version();
+			built_ = true;
+		}
+
+		if (dirty_.empty()) return;
+
+		// A rebuild only reads the arena and writes its own cluster.
+		WorkerPool::shared().run(dirty_.size(), [&](std::size_t job) {
+			LocalSearch search;
+			rebuild(dirty_[job], search);
+		});
+
+		// Entrances of the rebuilt clusters may have been renumbered, which
+		// breaks the links into them from their neighbours too.
+		for (int cluster : dirty_) {
+			resolve_links(cluster);
+
+			Coord cell(cluster % width_, cluster / width_);
+			for (auto diff : hex_directions) {
+				Coord other = cell + diff;
+				if (other.x >= 0 && other.y >= 0 && other.x < width_ && other.y < width_) {
+					resolve_links(other.y * width_ + other.x);
+				}
+			}
+		}
+
+		dirty_.clear();
+	}
+
+	void ClusterPaths::resolve_links(int cluster) {
+		for (auto& link : clusters_[cluster].links) {
+			int entrance = entrance_index(link.cluster, link.to);
+			assert(entrance >= 0);
+			link.node = link.cluster * max_entrances + entrance;
+		}
+	}
+
+	void ClusterPaths::border(int a, int b, std::vector<std::pair<Coord, Coord>>& entrances) const {
+		assert(a < b);
+
+		Coord o = origin(a);
+		int size = static_cast<int>(arena_.size);
+		int w = std::min(K, size - o.x);
+		int h = std::min(K, size - o.y);
+
+		std::vector<std::pair<Coord, Coord>> run;
+
+		// Splits a run of neighbouring open hexes into pieces of at most
+		// entrance_width and puts an entrance in the middle of each.
+		auto flush = [&]() {
+			int length = static_cast<int>(run.size());
+			int pieces = (length + entrance_width - 1) / entrance_width;
+
+			for (int i = 0; i < pieces; ++i) {
+				int begin = length * i / pieces;
+				int end = length * (i + 1) / pieces;
+				entrances.push_back(run[(begin + end) / 2]);
+			}
+
+			run.clear();
+		};
+
+		// Going row by row, consecutive hexes of the same run are always neighbours.
+		// The run also has to stay connected on the other side, so that every
+		// crossing in it can reach the entrance on both sides of the border.
+		for (int y = o.y; y < o.y + h; ++y) {
+			for (int x = o.x; x < o.x + w; ++x) {
+				bool inner = x > o.x && x < o.x + w - 1 && y > o.y && y < o.y + h - 1;
+				Coord c(x, y);
+				if (inner || arena_.hexes(c) == HexType::Wall) continue;
+
+				for (auto diff : hex_directions) {
+					auto neighbour = c + diff;
+					if (!arena_.is_valid_coord(neighbour) || cluster_of(neighbour) != b) continue;
+					if (arena_.hexes(neighbour) == HexType::Wall) continue;
+
+					if (!run.empty() && (hex_distance(run.back().first, c) != 1 || hex_distance(run.back().second, neighbour) > 1)) {
+						flush();
+					}
+
+					run.push_back({ c, neighbour });
+					break;
+				}
+			}
+		}
+
+		if (!run.empty()) {
+			flush();
+		}
+	}
+
+	void ClusterPaths::rebuild(int index, LocalSearch& search) {
+		auto& cluster = clusters_[index];
+		cluster.entrances.clear();
+		cluster.links.clear();
+
+		std::vector<std::pair<Coord, Coord>> pairs;
+		Coord cell(index % width_, index / width_);
+
+		// Clusters border each other in the same six directions as hexes.
+		for (auto diff : hex_directions) {
+			Coord other = cell + diff;
+			if (other.x < 0 || other.y < 0 || other.x >= width_ || other.y >= width_) continue;
+
+			int neighbour = other.y * width_ + other.x;
+
+			pairs.clear();
+			if (index < neighbour) {
+				border(index, neighbour, pairs);
+			} else {
+				border(neighbour, index, pairs);
+			}
+
+			for (auto& pair : pairs) {
+				Coord mine = index < neighbour ? pair.first : pair.second;
+				Coord theirs = index < neighbour ? pair.second : pair.first;
+
+				int entrance = entrance_index(index, mine);
+				if (entrance < 0) {
+					entrance = static_cast<int>(cluster.entrances.size());
+					cluster.entrances.push_back(mine);
+				}
+
+				cluster.links.push_back({ entrance, neighbour, theirs, arena_.move_cost(theirs) });
+			}
+		}
+
+		assert(cluster.entrances.size() <= max_entrances);
+
+		std::size_t count = cluster.entrances.size();
+		cluster.costs.assign(count * count, std::numeric_limits<int>::max());
+
+		Coord o = origin(index);
+		for (std::size_t from = 0; from < count; ++from) {
+			search_cluster(cluster.entrances[from], false, search);
+
+			for (std::size_t to = 0; to < count; ++to) {
+				cluster.costs[from * count + to] = search.cost[local_index(cluster.entrances[to], o)];
+			}
+		}
+
+		cluster.dirty = false;
+	}
+
+	void ClusterPaths::search_cluster(Coord source, bool reverse, LocalSearch& search, Coord stop) const {
+		Coord o = origin(cluster_of(source));
+		int size = static_cast<int>(arena_.size);
+		int w = std::min(K, size - o.x);
+		int h = std::min(K, size - o.y);
+
+		search.cost.fill(std::numeric_limits<int>::max());
+		for (auto& bucket : search.buckets) {
+			bucket.clear();
+		}
+
+		search.cost[local_index(source, o)] = 0;
+		search.buckets[0].push_back(local_index(source, o));
+
+		// Hexes are queued again instead of moved when they get cheaper, the
+		// stale entries are skipped when their bucket comes up.
+		std::size_t queued = 1;
+		for (int distance = 0; queued > 0; ++distance) {
+			auto& bucket = search.buckets[distance % search.buckets.size()];
+
+			while (!bucket.empty()) {
+				int index = bucket.back();
+				bucket.pop_back();
+				queued--;
+
+				if (search.cost[index] != distance) continue;
+
+				Coord current(o.x + index % K, o.y + index / K);
+				if (current == stop) return;
+
+				for (int direction = 0; direction < 6; ++direction) {
+					auto neighbour = current + hex_directions[direction];
+					if (neighbour.x < o.x || neighbour.y < o.y || neighbour.x >= o.x + w || neighbour.y >= o.y + h) continue;
+					if (arena_.hexes(neighbour) == HexType::Wall) continue;
+
+					// Walking backwards, the step into `current` is the one being paid for.
+					int cost = distance + arena_.move_cost(reverse ? current : neighbour);
+					int i = local_index(neighbour, o);
+
+					if (cost < search.cost[i]) {
+						search.cost[i] = cost;
+						search.parent[i] = static_cast<std::uint8_t>(direction);
+						search.buckets[cost % search.buckets.size()].push_back(i);
+						queued++;
+					}
+				}
+			}
+		}
+	}
+
+	ClusterPaths::SearchNode& ClusterPaths::visit(int node) {
+		auto& result = search_[node];
+		if (result.generation != generation_) {
+			result.cost = std::numeric_limits<int>::max();
+			result.parent = -1;
+			result.generation = generation_;
+		}
+		return result;
+	}
+
+	void ClusterPaths::relax(int node, Coord c, int cost, int parent, Coord to) {
+		auto& next = visit(node);
+		if (cost >= next.cost) return;
+
+		next.cost = cost;
+		next.parent = parent;
+
+		int heuristic = hex_distance(c, to) * MIN_MOVE_COST;
+		open_.push_back({ cost + heuristic, cost, node });
+		std::push_heap(open_.begin(), open_.end(), std::greater<OpenNode>());
+	}
+
+	bool ClusterPaths::plan(Coord from, Coord to, std::vector<Coord>& waypoints) {
+		waypoints.clear();
+		update();
+
+		if (!arena_.is_valid_coord(from) || !arena_.is_valid_coord(to)) return false;
+		if (arena_.hexes(from) == HexType::Wall || arena_.hexes(to) == HexType::Wall) return false;
+
+		if (++generation_ == 0) {
+			for (auto& node : search_) {
+				node.generation = 0;
+			}
+			generation_ = 1;
+		}
+
+		open_.clear();
+
+		int goal = static_cast<int>(search_.size()) - 1;
+		int start_cluster = cluster_of(from);
+		int goal_cluster = cluster_of(to);
+
+		// The start and the goal aren't part of the graph, they are connected
+		// to the entrances of their clusters for just this query.
+		auto& last = clusters_[goal_cluster];
+		search_cluster(to, true, local_);
+
+		goal_costs_.resize(last.entrances.size());
+		for (std::size_t i = 0; i < last.entrances.size(); ++i) {
+			goal_costs_[i] = local_.cost[local_index(last.entrances[i], origin(goal_cluster))];
+		}
+
+		auto& first = clusters_[start_cluster];
+		search_cluster(from, false, local_);
+
+		if (start_cluster == goal_cluster) {
+			int direct = local_.cost[local_index(to, origin(start_cluster))];
+			if (direct != std::numeric_limits<int>::max()) {
+				relax(goal, to, direct, -1, to);
+			}
+		}
+
+		for (std::size_t i = 0; i < first.entrances.size(); ++i) {
+			int cost = local_.cost[local_index(first.entrances[i], origin(start_cluster))];
+			if (cost != std::numeric_limits<int>::max()) {
+				relax(start_cluster * max_entrances + static_cast<int>(i), first.entrances[i], cost, -1, to);
+			}
+		}
+
+		while (!open_.empty()) {
+			std::pop_heap(open_.begin(), open_.end(), std::greater<OpenNode>());
+			auto top = open_.back();
+			open_.pop_back();
+
+			if (top.cost > search_[top.node].cost) continue;
+
+			if (top.node == goal) {
+				cost_ = top.cost;
+
+				waypoints.push_back(to);
+				for (int node = search_[goal].parent; node != -1; node = search_[node].parent) {
+					waypoints.push_back(clusters_[node / max_entrances].entrances[node % max_entrances]);
+				}
+				waypoints.push_back(from);
+
+				std::reverse(waypoints.begin(), waypoints.end());
+				waypoints.erase(std::unique(waypoints.begin(), waypoints.end()), waypoints.end());
+				return true;
+			}
+
+			int index = top.node / max_entrances;
+			int entrance = top.node % max_entrances;
+			auto& cluster = clusters_[index];
+			int count = static_cast<int>(cluster.entrances.size());
+
+			for (int i = 0; i < count; ++i) {
+				int cost = cluster.costs[entrance * count + i];
+				if (i != entrance && cost != std::numeric_limits<int>::max()) {
+					relax(index * max_entrances + i, cluster.entrances[i], top.cost + cost, top.node, to);
+				}
+			}
+
+			for (auto& link : cluster.links) {
+				if (link.from == entrance) {
+					relax(link.node, link.to, top.cost + link.cost, top.node, to);
+				}
+			}
+
+			if (index == goal_cluster && goal_costs_[entrance] != std::numeric_limits<int>::max()) {
+				relax(goal, to, top.cost + goal_costs_[entrance], top.node, to);
+			}
+		}
+
+		return false;
+	}
+
+	void ClusterPaths::refine(Coord from, Coord to, std::vector<Coord>& path) {
+		if (from == to) return;
+
+		// Stepping straight onto `to` is as cheap as any other way of entering it.
+		if (hex_distance(from, to) == 1) {
+			path.push_back(to);
+			return;
+		}
+
+		assert(cluster_of(from) == cluster_of(to));
+
+		search_cluster(from, false, local_, to);
+		Coord o = origin(cluster_of(from));
+
+		std::size_t begin = path.size();
+		for (Coord c = to; c != from;) {
+			path.push_back(c);
+			c = c + hex_directions[opposite_direction(local_.parent[local_index(c, o)])];
+		}
+
+		std::reverse(path.begin() + begin, path.end());
+	}
+
+	bool ClusterPaths::find_path(Coord from, Coord to, std::vector<Coord>& path, std::size_t max_steps) {
+		path.clear();
+
+		if (!plan(from, to, waypoints_)) return false;
+
+		for (std::size_t i = 1; i < waypoints_.size() && path.size() < max_steps; ++i) {
+			refine(waypoints_[i - 1], waypoints_[i], path);
+		}
+
+		return true;
+	}
+
+	std::size_t ClusterPaths::entrance_count() const {
+		std::size_t total = 0;
+		for (auto& cluster : clusters_) {
+			total += cluster.entrances.size();
+		}
+		return total;
+	}
+
+	std::size_t ClusterPaths::memory() const {
+		std::size_t total = clusters_.capacity() * sizeof(Cluster) + search_.capacity() * sizeof(SearchNode) +
+			dirty_.capacity() * sizeof(int);
+		for (auto& cluster : clusters_) {
+			total += cluster.entrances.capacity() * sizeof(Coord) +
+				cluster.costs.capacity() * sizeof(int) +
+				cluster.links.capacity() * sizeof(Link);
+		}
+		return total;
+	}
+}
@@ -0,0 +1,58 @@
+#include <model.hpp>
+
+namespace model
+{
+	DistanceField::DistanceField(std::size_t size)
+		: distance_(size, std::numeric_limits<int>::max()),
+		  nearest_(size, -1),
+		  queue_(MAX_MOVE_COST + MIN_MOVE_COST, size) {}
+
+	void DistanceField::compute(const Arena& arena, const PlayerInfo& info, const std::vector<FieldSeed>& seeds) {
+		assert(arena.size == distance_.size());
+
+		distance_.fill(std::numeric_limits<int>::max());
+		nearest_.fill(-1);
+		queue_.clear();
+
+		for (auto& seed : seeds) {
+			if (distance_(seed.c) == 0) continue;
+
+			distance_(seed.c) = 0;
+			nearest_(seed.c) = seed.id;
+			queue_.push(0, seed.c);
+		}
+
+		// Dial's algorithm from every seed at once. It runs backwards, a step
+		// from a neighbour onto `current` costs entering `current`, so the hexes
+		// are reached in order of distance and the first seed to get somewhere
+		// is the closest. A hex can only get cheaper while it's still queued.
+		while (!queue_.empty()) {
+			int distance;
+			Coord current = queue_.pop(distance);
+			int next = distance + arena.move_cost(current);
+			int id = nearest_(current);
+
+			for (auto neighbour : arena.hexes.neighbours(current)) {
+				if (arena.hexes(neighbour) == HexType::Wall) continue;
+
+				int& d = distance_(neighbour);
+				if (next >= d) continue;
+
+				if (!info.occupied(neighbour)) {
+					if (d == std::numeric_limits<int>::max()) {
+						queue_.push(next, neighbour);
+					} else {
+						queue_.decrease(d, next, neighbour);
+					}
+				}
+
+				d = next;
+				nearest_(neighbour) = id;
+			}
+		}
+
+		terrain_version = arena.terrain_version();
+		occupancy_version = info.occupancy_version();
+		computed = true;
+	}
+}
@@ -0,0 +1,109 @@
+#include <atomic>
+#include <model.hpp>
+#include <worker_pool.hpp>
+
+namespace model
+{
+	DistanceOracle::DistanceOracle(const Arena& arena)
+		: arena_(arena),
+		  cells_(arena.size * arena.size),
+		  row_(arena.size),
+		  queue_(MAX_MOVE_COST + MIN_MOVE_COST, arena.size),
+		  row_source_(-1, -1) {}
+
+	int DistanceOracle::distance(Coord from, Coord to) {
+		assert(arena_.is_valid_coord(from) && arena_.is_valid_coord(to));
+		update();
+
+		if (precomputed()) {
+			std::size_t index = row_.index(from) * cells_ + row_.index(to);
+
+			if (narrow()) {
+				auto d = table8_[index];
+				return d == std::numeric_limits<std::uint8_t>::max() ? std::numeric_limits<int>::max() : d;
+			} else {
+				auto d = table16_[index];
+				return d == std::numeric_limits<std::uint16_t>::max() ? std::numeric_limits<int>::max() : d;
+			}
+		}
+
+		if (row_source_ != from) {
+			fill_row(from, row_, queue_);
+			row_source_ = from;
+		}
+
+		return row_(to);
+	}
+
+	void DistanceOracle::update() {
+		if (built_ && terrain_version_ == arena_.terrain_version()) return;
+
+		terrain_version_ = arena_.terrain_version();
+		built_ = true;
+		row_source_ = { -1, -1 };
+
+		if (precomputed()) {
+			if (narrow()) {
+				build_table(table8_);
+			} else {
+				build_table(table16_);
+			}
+		}
+	}
+
+	void DistanceOracle::fill_row(Coord source, HexGrid<int>& distances, BucketQueue& queue) const {
+		distances.fill(std::numeric_limits<int>::max());
+		queue.clear();
+
+		if (arena_.hexes(source) == HexType::Wall) return;
+
+		distances(source) = 0;
+		queue.push(0, source);
+
+		// Dial's algorithm like Arena::flood_fill. A hex can only get cheaper
+		// while it's still queued, so anything already reached is in the queue.
+		while (!queue.empty()) {
+			int distance;
+			Coord current = queue.pop(distance);
+
+			for (auto neighbour : arena_.hexes.neighbours(current)) {
+				if (arena_.hexes(neighbour) == HexType::Wall) continue;
+
+				int cost = distance + arena_.move_cost(neighbour);
+				int& d = distances(neighbour);
+				if (cost >= d) continue;
+
+				if (d == std::numeric_limits<int>::max()) {
+					queue.push(cost, neighbour);
+				} else {
+					queue.decrease(d, cost, neighbour);
+				}
+				d = cost;
+			}
+		}
+	}
+
+	template <typename T>
+	void DistanceOracle::build_table(std::vector<T>& table) {
+		table.resize(cells_ * cells_);
+
+		// Sources are handed out one row at a time, every job has its own flood fill buffers.
+		auto& pool = WorkerPool::shared();
+		std::atomic<std::size_t> next_source{ 0 };
+
+		pool.run(std::min(pool.thread_count(), cells_ / 64 + 1), [&](std::size_t) {
+			HexGrid<int> distances(arena_.size);
+			BucketQueue queue(MAX_MOVE_COST + MIN_MOVE_COST, arena_.size);
+
+			for (std::size_t source = next_source++; source < cells_; source = next_source++) {
+				Coord c(static_cast<int>(source % arena_.size), static_cast<int>(source / arena_.size));
+				fill_row(c, distances, queue);
+
+				T* row = table.data() + row_.index(c) * cells_;
+				for (int d : distances) {
+					*row++ = d == std::numeric_limits<int>::max() ? std::numeric_limits<T>::max() : static_cast<T>(d);
+				}
+			}
+		});
+	}
+}
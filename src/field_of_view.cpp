@@ -0,0 +1,84 @@
+#include <cmath>
+#include <model.hpp>
+
+namespace model
+{
+	namespace
+	{
+		constexpr int vision_cells = hex_area(MAX_ABILITY_RANGE);
+		constexpr int vision_width = 2 * MAX_ABILITY_RANGE + 1;
+
+		// For every offset in the spiral, the hexes strictly between it and the
+		// origin that a wall would have to be on to block the line.
+		struct RayTable
+		{
+			Coord lines[vision_cells][MAX_ABILITY_RANGE];
+			int line_lengths[vision_cells];
+			// Spiral index of each offset, shifted by MAX_ABILITY_RANGE.
+			int index[vision_width][vision_width];
+
+			RayTable() : lines(), line_lengths(), index() {
+				for (int i = 0; i < vision_cells; ++i) {
+					auto o = spiral_offsets[i];
+					index[o.y + MAX_ABILITY_RANGE][o.x + MAX_ABILITY_RANGE] = i;
+				}
+
+				for (int i = 1; i < vision_cells; ++i) {
+					Cube target(spiral_offsets[i]);
+					int n = Coord(target).distance();
+
+					for (int step = 1; step < n; ++step) {
+						// The nudge keeps lines running exactly along hex edges
+						// from flipping between the two sides.
+						double t = static_cast<double>(step) / n;
+						double x = 1e-6 + target.x * t;
+						double y = 2e-6 + target.y * t;
+						double z = -3e-6 + target.z * t;
+
+						lines[i][line_lengths[i]++] = round(x, y, z);
+					}
+				}
+			}
+
+			static Coord round(double x, double y, double z) {
+				double rx = std::round(x);
+				double ry = std::round(y);
+				double rz = std::round(z);
+
+				double dx = std::abs(rx - x);
+				double dy = std::abs(ry - y);
+				double dz = std::abs(rz - z);
+
+				if (dx > dy && dx > dz) {
+					rx = -ry - rz;
+				} else if (dy > dz) {
+					ry = -rx - rz;
+				} else {
+					rz = -rx - ry;
+				}
+
+				return Coord(Cube(static_cast<int>(rx), static_cast<int>(ry), static_cast<int>(rz)));
+			}
+		};
+
+		const RayTable& rays() {
+			static const RayTable table;
+			return table;
+		}
+	}
+
+	bool line_of_sight(const HexGrid<HexType>& hexes, Coord from, Coord to) {
+		auto offset = to - from;
+		if (offset.distance() > MAX_ABILITY_RANGE) return false;
+
+		auto& table = rays();
+		int i = table.index[offset.y + MAX_ABILITY_RANGE][offset.x + MAX_ABILITY_RANGE];
+
+		for (int step = 0; step < table.line_lengths[i]; ++step) {
+			auto c = from + table.lines[i][step];
+			if (hexes.contains(c) && hexes(c) == HexType::Wall) return false;
+		}
+
+		return true;
+	}
+}
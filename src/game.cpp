@@ -4,6 +4,7 @@
 #define NOMINMAX
 
 #include <algorithm>
+#include <random>
 #include <string>
 #include <vector>
 
@@ -45,7 +46,7 @@ namespace game
 						InputManager& input_manager)
 	{
 		if (!turn_manager.current_turn.is_done()) {
-			auto* player = *turn_manager.current_turn.current_;
+			auto player = turn_manager.current_mob();
 			auto target = game.info.can_attack(*player, input_manager.mouse_hex);
 
 			ImGui::Begin("Current player");
@@ -55,7 +56,7 @@ namespace game
 			for (auto&& ability : player->abilities) {
 				std::string usable = "";
 				if (target) {
-					if (player->can_use_ability_at(*target, game.info, game.arena, ability)) {
+					if (player->can_use_ability_at(*target, game, ability)) {
 						usable = "* ";
 					}
 				}
@@ -94,6 +95,10 @@ namespace game
 
 		ImGui_ImplSdlGL3_Init(window);
 
+		// A new game every time it's started, everything random is derived from the master seed.
+		set_master_seed(std::random_device{}());
+		Rng rng(master_seed());
+
 		GameInstance game(20);
 		Arena& arena = game.arena;
 		PlayerInfo& info = game.info;
@@ -107,15 +112,21 @@ namespace game
 
 		for (int i = 0; i < 10; i++) {
 			auto t = i < 5 ? t1 : t2;
-			Mob& mob = info.add_mob(generator::random_mob(t, arena.size));
+
+			auto mob = generator::random_mob(t, arena.size, rng);
+			while (info.mob_at(mob.c)) {
+				mob.c = generator::random_coord(arena.size, rng);
+			}
+
+			info.add_mob(mob);
 		}
 
-		TurnManager turn_manager(info);
-		turn_manager.current_turn = game.start_turn();
+		TurnManager turn_manager(game.state);
+		game.start_turn();
 		turn_manager.update_arena(arena);
 
-		Mob* current_player = *turn_manager.current_turn.current_;
-		arena.dijkstra(current_player->c, info);
+		auto current_player = turn_manager.current_mob();
+		arena.use_paths(current_player->c, game.mob_paths.of(*current_player, arena, info));
 		arena.regenerate_geometry(current_player->ap);
 
 		gl::Camera camera;
@@ -172,7 +183,7 @@ namespace game
 			//	arena.paint_hex(arena.pos(c), Arena::radius, highlight_color);
 			//}
 
-			for (auto& mob : info.mobs) {
+			for (auto mob : info.mobs) {
 				arena.paint_mob(turn_manager, info, mob);
 			}
 
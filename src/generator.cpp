@@ -1,23 +1,24 @@
-#include <random>
 #include <model.hpp>
 #include <simulation.hpp>
 
 namespace generator
 {
-	model::Mob random_mob(Index<model::Team> team, std::size_t size) {
-		std::random_device rd;
-		std::mt19937 gen(rd());
-		std::uniform_int_distribution<int> dis(1, 10);
-		std::uniform_int_distribution<int> cost_dis(3, 7);
-		std::uniform_int_distribution<int> pos_dis(0, (int)size - 1);
-
-		model::Mob::abilities_t abilities;
+	model::MobData random_mob(int team, std::size_t size, model::Rng& rng) {
+		model::MobData::abilities_t abilities;
 		for (int i = 0; i < simulation::ABILITY_COUNT; ++i) {
-			abilities.emplace_back(dis(gen), dis(gen), cost_dis(gen));
+			int d_hp = rng.range(1, 10);
+			int d_ap = rng.range(1, 10);
+			abilities[i] = model::Ability(d_hp, d_ap, rng.range(3, 7));
 		}
 
-		auto mob =  model::Mob{ 10, 10, abilities, team};
-		mob.c = { pos_dis(gen), pos_dis(gen) };
+		auto mob =  model::MobData{ 10, model::MAX_AP, abilities, team};
+		mob.c = random_coord(size, rng);
 		return mob;
 	}
+
+	model::Coord random_coord(std::size_t size, model::Rng& rng) {
+		int x = rng.range(0, (int)size - 1);
+		int y = rng.range(0, (int)size - 1);
+		return { x, y };
+	}
 }
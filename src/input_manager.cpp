@@ -7,7 +7,7 @@
 using namespace model;
 using namespace glm;
 
-void InputManager::mousemove(glm::vec2 pos, Mob& player)
+void InputManager::mousemove(glm::vec2 pos, Mob player)
 {
 	highlight_hex = game::hex_at_mouse(camera_.projection(), arena_, event.motion.x, event.motion.y);
 	mouse_hex = highlight_hex;
@@ -15,11 +15,11 @@ void InputManager::mousemove(glm::vec2 pos, Mob& player)
 	highlight_path = build_highlight_path(player);
 }
 
-void InputManager::left_click(glm::vec2 pos, Mob& current_mob)
+void InputManager::left_click(glm::vec2 pos, Mob current_mob)
 {
 	auto click_hex = game::hex_at_mouse(camera_.projection(), arena_, event.motion.x, event.motion.y);
 	
-	auto&& player = current_mob.team->player();
+	auto&& player = info_.team_id(current_mob.team).player();
 
 	if (player.is_ai()) {
 		fmt::print("Forcing AI to take a turn\n");
@@ -32,23 +32,38 @@ void InputManager::left_click(glm::vec2 pos, Mob& current_mob)
 
 	}
 
-	arena_.dijkstra(current_mob.c, info_);
+	arena_.use_paths(current_mob.c, game_.mob_paths.of(current_mob, arena_, info_));
 	arena_.regenerate_geometry(current_mob.ap);
 }
 
-void InputManager::right_click(glm::vec2 pos, Mob& player)
+void InputManager::right_click(glm::vec2 pos, Mob player)
 {
 	auto click_hex = game::hex_at_mouse(camera_.projection(), arena_, event.motion.x, event.motion.y);
 
-	if (arena_(click_hex) == HexType::Empty) {
-		arena_(click_hex) = HexType::Wall;
-	} else {
-		arena_(click_hex) = HexType::Empty;
-	}
-	arena_.dijkstra(player.c, info_);
+	auto type = arena_(click_hex) == HexType::Empty ? HexType::Wall : HexType::Empty;
+
+	std::vector<Coord> changed;
+	arena_.set_hex(click_hex, type, info_, changed);
+	game_.clusters.invalidate(click_hex);
 	arena_.regenerate_geometry();
 }
 
+void InputManager::middle_click(glm::vec2 pos, Mob player)
+{
+	auto click_hex = game::hex_at_mouse(camera_.projection(), arena_, event.motion.x, event.motion.y);
+
+	// Cycles through the movement costs, from plain ground to the deepest mud.
+	int cost = arena_.move_cost(click_hex) + 1;
+	if (cost > MAX_MOVE_COST) {
+		cost = MIN_MOVE_COST;
+	}
+
+	std::vector<Coord> changed;
+	arena_.set_move_cost(click_hex, cost, info_, changed);
+	game_.clusters.invalidate(click_hex);
+	arena_.regenerate_geometry(player.ap);
+}
+
 std::vector<model::Coord>
 InputManager::build_highlight_path(const model::Mob& player)
 {
@@ -56,21 +71,14 @@ InputManager::build_highlight_path(const model::Mob& player)
 	std::vector<model::Coord> path;
 
 	if (arena_(highlight_hex) != HexType::Wall) {
-		while (highlight_hex != player.c) {
-			if (arena_(highlight_hex) == HexType::Wall) {
-				path.clear();
-				break;
-			}
-
-			if (auto source = arena_.paths(highlight_hex).source) {
-				highlight_hex = *source;
-				if (arena_(highlight_hex) == HexType::Empty) {
-					path.push_back(highlight_hex);
-				}
-			} else {
-				path.clear();
-				break;
-			}
+		// Nothing that far can be reached this turn anyway, so the route
+		// around the walls is enough and doesn't search the whole arena.
+		bool found = hex_distance(player.c, highlight_hex) > MAX_AP
+			? game_.clusters.find_path(player.c, highlight_hex, path)
+			: arena_.find_path(player.c, highlight_hex, std::numeric_limits<int>::max(), info_, path);
+
+		if (found) {
+			highlight_hex = player.c;
 		}
 	}
 
@@ -87,7 +95,7 @@ bool InputManager::handle_events()
 		// TODO - rewrite this
 		auto& turn = turn_manager_.current_turn;
 		if (!turn.is_done()) {
-			auto& player = **turn_manager_.current_turn.current_;
+			auto player = *turn_manager_.current_mob();
 
 			switch (event.type) {
 				case SDL_MOUSEMOTION:
@@ -103,6 +111,9 @@ bool InputManager::handle_events()
 						case SDL_BUTTON_RIGHT:
 							right_click(pos, player);
 							break;
+						case SDL_BUTTON_MIDDLE:
+							middle_click(pos, player);
+							break;
 					}
 			}
 
@@ -116,17 +127,16 @@ bool InputManager::handle_events()
 			camera_.keydown(event.key.keysym.sym);
 		if (event.type == SDL_KEYUP)
 			if (event.key.keysym.sym == SDLK_SPACE) {
-				// TODO - dijkstra for current player
-				auto* next_player = turn_manager_.current_turn.next();
+				auto next_player = turn_manager_.next_mob();
 				if (next_player) {
-					arena_.dijkstra(next_player->c, info_);
+					arena_.use_paths(next_player->c, game_.mob_paths.of(*next_player, arena_, info_));
 					arena_.regenerate_geometry(next_player->ap);
 				}
 
 				if (turn_manager_.current_turn.is_done()) {
 					// TODO - use proper logging
 					fmt::print("DEBUG - starting new turn\n");
-					turn_manager_.current_turn = game_.start_turn();
+					game_.start_turn();
 				}
 			} else {
 				camera_.keyup(event.key.keysym.sym);
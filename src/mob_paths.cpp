@@ -0,0 +1,56 @@
+#include <model.hpp>
+#include <worker_pool.hpp>
+
+namespace model
+{
+	bool MobPaths::is_current(const Entry& entry, Coord start, const Arena& arena, const PlayerInfo& info) const {
+		return entry.valid &&
+			entry.start == start &&
+			entry.terrain_version == arena.terrain_version() &&
+			entry.occupancy_version == info.occupancy_version();
+	}
+
+	void MobPaths::fill(Entry& entry, Coord start, const Arena& arena, const PlayerInfo& info) {
+		arena.flood_fill(start, info, entry.tree, entry.queue);
+
+		entry.start = start;
+		entry.terrain_version = arena.terrain_version();
+		entry.occupancy_version = info.occupancy_version();
+		entry.valid = true;
+	}
+
+	void MobPaths::compute(const Arena& arena, const PlayerInfo& info) {
+		while (entries_.size() < info.mobs.size()) {
+			entries_.emplace_back(arena.size);
+		}
+
+		std::vector<std::size_t> pending;
+		for (std::size_t i = 0; i < info.mobs.size(); ++i) {
+			if (info.mobs.hp(i) > 0 && !is_current(entries_[i], info.mobs.c(i), arena, info)) {
+				pending.push_back(i);
+			}
+		}
+
+		// Every job only writes to the entry of its own mob.
+		WorkerPool::shared().run(pending.size(), [&](std::size_t job) {
+			std::size_t i = pending[job];
+			fill(entries_[i], info.mobs.c(i), arena, info);
+		});
+	}
+
+	const PathTree& MobPaths::of(const Mob& mob, const Arena& arena, const PlayerInfo& info) {
+		assert(mob.index >= 0 && static_cast<std::size_t>(mob.index) < info.mobs.size());
+		std::size_t i = mob.index;
+
+		while (entries_.size() <= i) {
+			entries_.emplace_back(arena.size);
+		}
+
+		auto& entry = entries_[i];
+		if (!is_current(entry, mob.c, arena, info)) {
+			fill(entry, mob.c, arena, info);
+		}
+
+		return entry.tree;
+	}
+}
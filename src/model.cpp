@@ -4,11 +4,19 @@
 #include <math.h>
 
 #include <stopwatch.hpp>
-#include <gl_utils.hpp>
 #include <model.hpp>
 #include <boost/optional.hpp>
 
 namespace model {
+	const Coord hex_directions[6] = {
+		{ -1, 0 },
+		{ 1, 0 },
+		{ 0, -1 },
+		{ 0, 1 },
+		{ 1, -1 },
+		{ -1, 1 }
+	};
+
 	int hex_distance(Coord a, Coord b) {
 		using std::abs;
 		return (abs(a.x - b.x)
@@ -68,7 +76,7 @@ namespace model {
 	}
 
 	float rnd(float max) {
-		return (static_cast<float>(rand()) / RAND_MAX) * max;
+		return thread_rng().uniform() * max;
 	}
 
 	float rnd() {
@@ -83,30 +91,299 @@ namespace model {
 		return x;
 	}
 
-	Arena::Arena(std::size_t size) : size(size), hexes(size), positions(size), paths(size) {
+	// Layout of the hexes in model space, pointy side up with rows shifted
+	// by half a hex, shared by regenerate_geometry and hex_near.
+	static const float grid_start_x = -0.5f;
+	static const float grid_start_y = -0.5f;
+	static const float hex_width = static_cast<float>(cos(30 * M_PI / 180) * Arena::radius * 2);
+	static const float hex_height_offset = static_cast<float>(Arena::radius + sin(30 * M_PI / 180) * Arena::radius);
+
+	BucketQueue::BucketQueue(int max_step, std::size_t size)
+		: buckets_(max_step + 1),
+		  slots_(size) {}
+
+	void BucketQueue::clear() {
+		for (auto& bucket : buckets_) {
+			bucket.clear();
+		}
+		size_ = 0;
+		current_ = 0;
+	}
+
+	void BucketQueue::push(int key, Coord c) {
+		// Nothing is left to keep in range, an empty queue can skip ahead.
+		if (size_ == 0 && key - current_ >= static_cast<int>(buckets_.size())) {
+			current_ = key;
+		}
+
+		assert(key >= current_ && key - current_ < static_cast<int>(buckets_.size()));
+
+		auto& b = bucket(key);
+		slot(c) = static_cast<std::uint32_t>(b.size());
+		b.push_back(c);
+
+		size_++;
+		peak_size_ = std::max(peak_size_, size_);
+	}
+
+	void BucketQueue::decrease(int old_key, int key, Coord c) {
+		assert(key <= old_key);
+		if (key == old_key) return;
+
+		// Swap the hex with the last one in its bucket so that it can be popped off.
+		auto& b = bucket(old_key);
+		std::uint32_t i = slot(c);
+		assert(b[i] == c);
+
+		b[i] = b.back();
+		slot(b[i]) = i;
+		b.pop_back();
+		size_--;
+
+		push(key, c);
+	}
+
+	int BucketQueue::min_key() const {
+		assert(size_ > 0);
+
+		int key = current_;
+		while (buckets_[key % buckets_.size()].empty()) {
+			key++;
+		}
+
+		return key;
+	}
+
+	std::size_t BucketQueue::memory() const {
+		std::size_t bytes = slots_.memory();
+		for (auto& bucket : buckets_) {
+			bytes += bucket.capacity() * sizeof(Coord);
+		}
+		return bytes;
+	}
+
+	Coord BucketQueue::pop(int& key) {
+		current_ = min_key();
+		key = current_;
+
+		auto& b = bucket(current_);
+		Coord c = b.back();
+		b.pop_back();
+		size_--;
+
+		return c;
+	}
+
+	PathTree::PathTree(std::size_t size)
+		: distances_(size),
+		  parents_(size),
+		  visited_((size * size + 63) / 64),
+		  open_((size * size + 63) / 64) {}
+
+	void PathTree::clear() {
+		std::fill(visited_.begin(), visited_.end(), 0);
+		std::fill(open_.begin(), open_.end(), 0);
+	}
+
+	boost::optional<Coord> PathTree::parent(Coord c) const {
+		int direction = parent_direction(c);
+		if (direction == no_parent) return boost::none;
+		return c + hex_directions[direction];
+	}
+
+	std::size_t PathTree::memory() const {
+		return distances_.memory() + parents_.memory() +
+			(visited_.capacity() + open_.capacity()) * sizeof(std::uint64_t);
+	}
+
+	GameState::GameState(std::size_t size)
+		: size(size),
+		  hexes(size),
+		  move_costs(size, MIN_MOVE_COST),
+		  info(size) {}
+
+	bool GameState::is_valid_coord(Coord c) const {
+		return static_cast<std::size_t>(c.abs().max()) < size && c.min() >= 0;
+	}
+
+	void GameState::set_hex(Coord c, HexType type) {
+		assert(is_valid_coord(c));
+		HexType previous = hexes(c);
+		hexes(c) = type;
+
+		if ((previous == HexType::Wall) != (type == HexType::Wall)) {
+			terrain_version_++;
+			terrain_hash_ ^= zobrist_key(ZobristFeature::Wall, 0, c);
+		}
+	}
+
+	void GameState::set_move_cost(Coord c, int cost) {
+		assert(is_valid_coord(c));
+		assert(cost >= MIN_MOVE_COST && cost <= MAX_MOVE_COST);
+
+		if (move_costs(c) == cost) return;
+
+		terrain_version_++;
+		terrain_hash_ ^= zobrist_key(ZobristFeature::MoveCost, move_costs(c), c) ^
+			zobrist_key(ZobristFeature::MoveCost, cost, c);
+		move_costs(c) = static_cast<std::uint8_t>(cost);
+	}
+
+	void GameState::start_turn() {
+		for (auto&& mob : info.mobs) {
+			info.set_ap(mob, std::min(mob.max_ap, mob.ap + mob.max_ap));
+		}
+
+		turn.reset(info.mobs);
+	}
+
+	std::uint64_t GameState::compute_hash() const {
+		std::uint64_t hash = 0;
+
+		for (int y = 0; y < static_cast<int>(size); ++y) {
+			for (int x = 0; x < static_cast<int>(size); ++x) {
+				Coord c(x, y);
+				if (hexes(c) == HexType::Wall) {
+					hash ^= zobrist_key(ZobristFeature::Wall, 0, c);
+				}
+				if (move_costs(c) != MIN_MOVE_COST) {
+					hash ^= zobrist_key(ZobristFeature::MoveCost, move_costs(c), c) ^
+						zobrist_key(ZobristFeature::MoveCost, MIN_MOVE_COST, c);
+				}
+			}
+		}
+
+		for (std::size_t i = 0; i < info.mobs.size(); ++i) {
+			auto index = static_cast<std::uint32_t>(i);
+			hash ^= zobrist_key(ZobristFeature::MobCoord, index, info.mobs.c(i)) ^
+				zobrist_key(ZobristFeature::MobHp, index, info.mobs.hp(i)) ^
+				zobrist_key(ZobristFeature::MobAp, index, info.mobs.ap(i));
+		}
+
+		for (std::size_t i = 0; i < turn.order().size(); ++i) {
+			hash ^= zobrist_key(ZobristFeature::TurnOrder, static_cast<std::uint32_t>(i), turn.order()[i].index);
+		}
+
+		return hash ^ zobrist_key(ZobristFeature::TurnCursor, static_cast<std::uint32_t>(turn.cursor()), 0u);
+	}
+
+	std::size_t GameState::memory() const {
+		return sizeof(GameState) + hexes.memory() + move_costs.memory() + info.memory();
+	}
+
+	Arena::Arena(GameState& state)
+		: state_(state),
+		  search_(state.size),
+		  queue_(MAX_MOVE_COST + MIN_MOVE_COST, state.size),
+		  size(state.size),
+		  hexes(state.hexes),
+		  move_costs(state.move_costs),
+		  positions(state.size),
+		  paths(state.size) {
+#ifndef HEXMAGE_HEADLESS
 		gl::Vertex::setup_attributes();
 		shader.set("projection", glm::mat4(1.0f));
+#endif
 	}
 
 	bool Arena::is_valid_coord(const Coord& c) const {
-		return static_cast<std::size_t>(c.abs().max()) < size && c.min() >= 0;
+		return state_.is_valid_coord(c);
+	}
+
+	unsigned Arena::terrain_version() const {
+		return state_.terrain_version();
 	}
 
 	HexType& Arena::operator()(Coord c) { return hexes(c); }
 	Position& Arena::pos(Coord c) { return positions(c); }
 
-	Coord Arena::hex_near(Position rel_pos) {
+	Position Arena::hex_center(Coord c) const {
+		float x = grid_start_x;
+		float y = grid_start_y;
+
+		// axial q-change
+		x += c.x * hex_width;
+		// axial r-change
+		x += c.y * (hex_width / 2);
+		y += c.y * hex_height_offset;
+
+		return{ x, y };
+	}
+
+	Coord Arena::hex_near(Position rel_pos) const {
+		// Fractional axial coordinates of the point, rounded in cube space so
+		// that the coordinate with the largest rounding error gets fixed up.
+		float r = (rel_pos.y - grid_start_y) / hex_height_offset;
+		float q = (rel_pos.x - grid_start_x) / hex_width - r / 2;
+		float s = -q - r;
+
+		float rq = std::round(q);
+		float rr = std::round(r);
+		float rs = std::round(s);
+
+		float dq = std::abs(rq - q);
+		float dr = std::abs(rr - r);
+		float ds = std::abs(rs - s);
+
+		if (dq > dr && dq > ds) {
+			rq = -rr - rs;
+		} else if (dr > ds) {
+			rr = -rq - rs;
+		}
+
+		int max = static_cast<int>(size) - 1;
+		Coord closest{
+			std::min(std::max(static_cast<int>(rq), 0), max),
+			std::min(std::max(static_cast<int>(rr), 0), max)
+		};
+
+		if (closest.x == static_cast<int>(rq) && closest.y == static_cast<int>(rr)) {
+			return closest;
+		}
+
+		// The point is outside of the arena, the clamped hex is on the right edge
+		// but not necessarily the closest one, walk along the edge towards the point.
+		float min = (hex_center(closest) - rel_pos).distance();
+
+		bool improved = true;
+		while (improved) {
+			improved = false;
+
+			for (auto diff : hex_directions) {
+				auto neighbour = closest + diff;
+				if (!is_valid_coord(neighbour)) continue;
+
+				float distance = (hex_center(neighbour) - rel_pos).distance();
+				if (distance < min) {
+					closest = neighbour;
+					min = distance;
+					improved = true;
+				}
+			}
+		}
+
+		return closest;
+	}
+
+	void Arena::hex_near(const std::vector<Position>& points, std::vector<Coord>& hexes) const {
+		hexes.resize(points.size());
+
+		for (std::size_t i = 0; i < points.size(); ++i) {
+			hexes[i] = hex_near(points[i]);
+		}
+	}
+
+	Coord Arena::hex_near_exhaustive(Position rel_pos) const {
 		Coord closest;
 		float min = INFINITY;
 
-		for (std::size_t i = 0; i < positions.m; ++i) {
-			for (std::size_t j = 0; j < positions.n;++j) {
-				auto pos = positions(i, j);
-
-				float distance = (pos - rel_pos).distance();
+		int isize = static_cast<int>(size);
+		for (int row = 0; row < isize; ++row) {
+			for (int col = 0; col < isize; ++col) {
+				float distance = (hex_center({ col, row }) - rel_pos).distance();
 
 				if (distance < min) {
-					closest = { static_cast<int>(j), static_cast<int>(i) };
+					closest = { col, row };
 					min = distance;
 				}
 			}
@@ -115,109 +392,381 @@ namespace model {
 		return closest;
 	}
 
+	Path Arena::path(Coord c) const {
+		return{ paths.parent(c), paths.distance(c) };
+	}
+
 	void Arena::dijkstra(Coord start, PlayerInfo& info) {
-		// TODO - proper log levels
-		fmt::printf("DEBUG Dijkstra started at %i,%i\n", start.x, start.y);
-		Stopwatch s;
+		start_ = start;
+		flood_filled_ = true;
 
-		std::queue<Coord> queue;
+		flood_fill(start, info, paths, queue_);
+	}
 
-		queue.push(start);
+	void Arena::flood_fill(Coord start, const PlayerInfo& info, PathTree& tree, BucketQueue& queue) const {
+		tree.clear();
+		queue.clear();
 
-		std::vector<Coord> diffs = {
-			{ -1, 0 },
-			{ 1, 0 },
-			{ 0, -1 },
-			{ 0, 1 },
-			{ 1, -1 },
-			{ -1, 1 }
-		};
+		tree.set(start, 0, PathTree::no_parent);
+		tree.set_open(start, true);
+		queue.push(0, start);
+
+		while (!queue.empty()) {
+			int distance;
+			Coord current = queue.pop(distance);
+
+			tree.set_open(current, false);
+			expand(current, distance, info, tree, queue);
+		}
+	}
 
-		int iterations = 0;
+	void Arena::use_paths(Coord start, const PathTree& tree) {
+		start_ = start;
+		flood_filled_ = true;
+		paths = tree;
+	}
 
-		for (int i = 0; i < paths.m; ++i) {
-			for (int j = 0; j < paths.n; ++j) {
-				auto& p = paths(i, j);
-				auto& h = hexes(i, j);
+	void Arena::expand(Coord current, int distance, const PlayerInfo& info, PathTree& tree, BucketQueue& queue) const {
+		auto neighbours = hexes.neighbours(current);
 
-				p.source = boost::none;
-				p.distance = std::numeric_limits<int>::max();
+		for (auto it = neighbours.begin(); it != neighbours.end(); ++it) {
+			auto neighbour = *it;
+			if (is_blocked(neighbour, info)) continue;
 
-				if (h == HexType::Wall || info.mob_at({j, i})) {
-					p.state = VertexState::Closed;
-				} else {
-					p.state = VertexState::Unvisited;
+			int cost = distance + move_cost(neighbour);
+			int previous = tree.distance(neighbour);
+			if (cost >= previous || cost > PathTree::max_distance) continue;
+
+			// Closed hexes only get here while repairing, when they can still
+			// get cheaper and have to be queued again.
+			if (tree.is_open(neighbour)) {
+				queue.decrease(previous, cost, neighbour);
+			} else {
+				tree.set_open(neighbour, true);
+				queue.push(cost, neighbour);
+			}
+
+			tree.set(neighbour, cost, opposite_direction(it.direction()));
+		}
+	}
+
+	std::size_t Arena::path_memory() const {
+		return paths.memory() + queue_.memory();
+	}
+
+	void Arena::reachable_cells(const Mob& mob, ReachableCells& cells) const {
+		assert(paths.distance(mob.c) == 0);
+		assert(mob.ap <= MAX_AP);
+
+		// A path can't be shorter than the straight line, so only the spiral
+		// up to `ap` has to be looked at.
+		int ap = std::min(mob.ap, MAX_AP);
+		std::size_t area = hex_area(std::max(ap, 0));
+
+		auto& counts = cells.cost_end_;
+		counts.fill(0);
+
+		for (std::size_t i = 1; i < area; ++i) {
+			auto c = mob.c + spiral_offsets[i];
+			if (!is_valid_coord(c)) continue;
+
+			int cost = paths.distance(c);
+			if (cost <= ap) {
+				counts[cost]++;
+			}
+		}
+
+		// Counting sort by cost, cost_end_ ends up as the prefix sums.
+		std::size_t total = 0;
+		for (auto& count : counts) {
+			total += count;
+			count = total - count;
+		}
+
+		cells.cells_.resize(total);
+
+		for (std::size_t i = 1; i < area; ++i) {
+			auto c = mob.c + spiral_offsets[i];
+			if (!is_valid_coord(c)) continue;
+
+			int cost = paths.distance(c);
+			if (cost <= ap) {
+				cells.cells_[counts[cost]++] = { c, cost };
+			}
+		}
+	}
+
+	bool Arena::is_blocked(Coord c, const PlayerInfo& info) const {
+		return hexes(c) == HexType::Wall || info.occupied(c);
+	}
+
+	void Arena::set_hex(Coord c, HexType type, PlayerInfo& info, std::vector<Coord>& changed) {
+		HexType previous = hexes(c);
+		state_.set_hex(c, type);
+
+		if ((previous == HexType::Wall) == (type == HexType::Wall)) return;
+
+		// Nothing to repair before the first flood fill.
+		if (!flood_filled_) return;
+
+		if (type == HexType::Wall) {
+			raise_cost(c, info, changed);
+		} else {
+			lower_cost(c, info, changed);
+		}
+	}
+
+	void Arena::set_move_cost(Coord c, int cost, PlayerInfo& info, std::vector<Coord>& changed) {
+		int previous = move_costs(c);
+		state_.set_move_cost(c, cost);
+
+		if (cost == previous || !flood_filled_ || hexes(c) == HexType::Wall) return;
+
+		if (cost > previous) {
+			raise_cost(c, info, changed);
+		} else {
+			lower_cost(c, info, changed);
+		}
+	}
+
+	void Arena::raise_cost(Coord c, PlayerInfo& info, std::vector<Coord>& changed) {
+		constexpr int infinity = std::numeric_limits<int>::max();
+
+		if (paths.distance(c) == infinity) {
+			// Nothing went through an unreachable or occupied cell.
+			return;
+		}
+
+		if (c == start_) {
+			// Stepping onto the start is never paid for, only a wall on it changes anything.
+			if (hexes(c) != HexType::Wall) return;
+
+			dijkstra(start_, info);
+
+			for (int row = 0; row < static_cast<int>(size); ++row) {
+				for (int col = 0; col < static_cast<int>(size); ++col) {
+					changed.push_back({ col, row });
 				}
 			}
+			return;
 		}
 
-		paths(start).distance = 0;
-		paths(start).state = VertexState::Open;
+		// Everything below `c` in the shortest path tree loses its distance,
+		// everything else keeps a path that didn't go through it.
+		std::size_t first = changed.size();
+		changed.push_back(c);
 
-		while (!queue.empty()) {
-			Coord current = queue.front();
-			queue.pop();
+		for (std::size_t i = first; i < changed.size(); ++i) {
+			Coord current = changed[i];
+
+			for (int direction = 0; direction < 6; ++direction) {
+				auto neighbour = current + hex_directions[direction];
+				if (!is_valid_coord(neighbour)) continue;
+
+				if (paths.parent_direction(neighbour) == opposite_direction(direction)) {
+					changed.push_back(neighbour);
+				}
+			}
+		}
+
+		for (std::size_t i = first; i < changed.size(); ++i) {
+			paths.reset(changed[i]);
+		}
+
+		open_.clear();
+
+		// Reseed the orphaned cells from their best neighbour outside of the
+		// subtree, `c` itself only if it can still be entered.
+		std::size_t seed_first = hexes(c) == HexType::Wall ? first + 1 : first;
+		for (std::size_t i = seed_first; i < changed.size(); ++i) {
+			Coord current = changed[i];
+			int cost = move_cost(current);
+			int best = infinity;
+			int best_direction = PathTree::no_parent;
+
+			for (int direction = 0; direction < 6; ++direction) {
+				auto neighbour = current + hex_directions[direction];
+				if (!is_valid_coord(neighbour)) continue;
+
+				int distance = paths.distance(neighbour);
+				if (distance != infinity && distance + cost < best) {
+					best = distance + cost;
+					best_direction = direction;
+				}
+			}
+
+			if (best <= PathTree::max_distance) {
+				paths.set(current, best, best_direction);
+				open_.push_back({ best, current });
+			}
+		}
+
+		// The seeds are spread over all distances, so they're fed into the
+		// bucket queue in order as it catches up with them.
+		std::sort(open_.begin(), open_.end(), [](const OpenNode& a, const OpenNode& b) { return a.cost < b.cost; });
+
+		queue_.clear();
+		std::size_t next_seed = 0;
+
+		while (true) {
+			if (next_seed < open_.size() && (queue_.empty() || open_[next_seed].cost <= queue_.min_key())) {
+				auto& seed = open_[next_seed++];
+
+				// Seeds that got cheaper through an earlier one are queued already.
+				if (!paths.is_open(seed.c) && paths.distance(seed.c) == seed.cost) {
+					paths.set_open(seed.c, true);
+					queue_.push(seed.cost, seed.c);
+				}
+				continue;
+			}
+
+			if (queue_.empty()) break;
+
+			int distance;
+			Coord current = queue_.pop(distance);
+
+			paths.set_open(current, false);
+			expand(current, distance, info, paths, queue_);
+		}
+	}
+
+	void Arena::lower_cost(Coord c, PlayerInfo& info, std::vector<Coord>& changed) {
+		// Stepping onto the start is never paid for, and a mob standing
+		// on the hex still blocks it.
+		if (c == start_ || info.occupied(c)) return;
+
+		int before = paths.distance(c);
+		int best = before;
+		int best_direction = PathTree::no_parent;
+		int cost = move_cost(c);
+
+		for (int direction = 0; direction < 6; ++direction) {
+			auto neighbour = c + hex_directions[direction];
+			if (!is_valid_coord(neighbour)) continue;
+
+			int distance = paths.distance(neighbour);
+			if (distance != PathTree::infinity && distance + cost < best) {
+				best = distance + cost;
+				best_direction = direction;
+			}
+		}
+
+		if (best >= before || best > PathTree::max_distance) return;
+
+		// A single seed, the changed cells come out of the queue in order
+		// of their new distance.
+		queue_.clear();
+		paths.set(c, best, best_direction);
+		paths.set_open(c, true);
+		queue_.push(best, c);
 
-			if (iterations > 10000 || queue.size() > 1000) {
-				std::cout << "dijkstra got stuck\titerations: " << iterations << ", queue: " << queue.size() << std::endl;
-				return;
+		while (!queue_.empty()) {
+			int distance;
+			Coord current = queue_.pop(distance);
+
+			paths.set_open(current, false);
+			changed.push_back(current);
+			expand(current, distance, info, paths, queue_);
+		}
+	}
+
+	Arena::SearchNode& Arena::search_visit(Coord c) {
+		auto& node = search_(c);
+
+		if (node.generation != search_generation_) {
+			node = SearchNode{};
+			node.generation = search_generation_;
+		}
+
+		return node;
+	}
+
+	bool Arena::find_path(Coord from, Coord to, int budget, PlayerInfo& info, std::vector<Coord>& path) {
+		path.clear();
+
+		if (!is_valid_coord(from) || !is_valid_coord(to) || hexes(to) == HexType::Wall) {
+			return false;
+		}
+
+		if (hex_distance(from, to) * MIN_MOVE_COST > budget) {
+			return false;
+		}
+
+		if (++search_generation_ == 0) {
+			for (auto& node : search_) {
+				node.generation = 0;
 			}
+			search_generation_ = 1;
+		}
+
+		auto& start = search_visit(from);
+		start.cost = 0;
 
-			iterations++;
+		// Every hex costs at least MIN_MOVE_COST, so the heuristic never
+		// overestimates and estimates grow by at most MAX_MOVE_COST + MIN_MOVE_COST
+		// per step, which keeps them in the range of the bucket queue.
+		queue_.clear();
+		queue_.push(hex_distance(from, to) * MIN_MOVE_COST, from);
 
-			Path& p = paths(current);
+		while (!queue_.empty()) {
+			int estimate;
+			Coord current = queue_.pop(estimate);
 
-			if (p.state == VertexState::Closed) continue;
+			auto& node = search_(current);
+
+			if (current == to) {
+				for (Coord c = to; c != from; c = search_(c).source) {
+					path.push_back(c);
+				}
+				std::reverse(path.begin(), path.end());
+				return true;
+			}
 
-			p.state = VertexState::Closed;
+			node.closed = true;
 
-			for (auto diff : diffs) {
+			for (auto diff : hex_directions) {
 				auto neighbour = current + diff;
-				if (is_valid_coord(neighbour)) {
-					Path& n = paths(neighbour);
+				if (!is_valid_coord(neighbour) || hexes(neighbour) == HexType::Wall) continue;
+				if (neighbour != to && info.occupied(neighbour)) continue;
 
-					if (n.state != VertexState::Closed) {
-						if (n.distance > p.distance + 1) {
-							n.distance = p.distance + 1;
-							assert(n.distance > 0);
+				auto& next = search_visit(neighbour);
+				int cost = node.cost + move_cost(neighbour);
+				if (next.closed || cost >= next.cost) continue;
 
-							n.source = current;
-						}
+				int heuristic = hex_distance(neighbour, to) * MIN_MOVE_COST;
+				if (cost + heuristic > budget) continue;
 
-						n.state = VertexState::Open;
-						queue.push(neighbour);
-					}
+				if (next.cost != std::numeric_limits<int>::max()) {
+					queue_.decrease(next.cost + heuristic, cost + heuristic, neighbour);
+				} else {
+					queue_.push(cost + heuristic, neighbour);
 				}
+
+				next.cost = cost;
+				next.source = current;
 			}
 		}
+
+		return false;
 	}
 
+#ifndef HEXMAGE_HEADLESS
 	void Arena::regenerate_geometry(boost::optional<int> current_ap) {
-		float start_x = -0.5f;
-		float start_y = -0.5f;
-
-		float width = static_cast<float>(cos(30 * M_PI / 180) * radius * 2);
-		float height_offset = static_cast<float>(radius + sin(30 * M_PI / 180) * radius);
-
 		b.clear();
 
 		int isize = static_cast<int>(size);
 		for (int row = 0; row < isize; ++row) {
 			for (int col = 0; col < isize; ++col) {
-				float draw_x = start_x;
-				float draw_y = start_y;
-
-				// axial q-change
-				draw_x += col * width;
-				// axial r-change
-				draw_x += row * (width / 2);
-				draw_y += row * height_offset;
-
-				pos({ col, row }) = { draw_x, draw_y };
+				pos({ col, row }) = hex_center({ col, row });
 
 				auto type = (*this)({ col, row });
 				Color c = color_for_type(type);
-				auto path = paths({ col, row });
+
+				// Rough terrain is drawn darker the more it costs to enter.
+				if (type == HexType::Empty) {
+					c = c.mut(-0.05f * (move_cost({ col, row }) - MIN_MOVE_COST));
+				}
+				auto path = this->path({ col, row });
 
 				if (path.distance < 0) {
 					if (path.source) {
@@ -311,63 +860,70 @@ namespace model {
 	void Arena::paint_mob(TurnManager& turn_manager, PlayerInfo& info, const Mob& mob)
 	{
 		auto p = pos(mob.c);
-		auto c = mob.team->color;
-		if (&mob == turn_manager.current_mob()) {
+		auto c = info.team_id(mob.team).color;
+		auto current = turn_manager.current_mob();
+		if (current && current->index == mob.index) {
 			c += glm::vec3(0.3f);
 		}
 		auto col = Color{ c.r, c.g, c.b };
 		paint_hex(p, radius, col);
 		paint_healthbar(p, (float)mob.hp / mob.max_hp, (float)mob.ap / mob.max_ap);
 	}
+#endif
 
-	Mob::Mob(int max_hp, int max_ap, abilities_t abilities, Index<Team> team) : max_hp(max_hp),
+	MobData::MobData(int max_hp, int max_ap, const abilities_t& abilities, int team) : max_hp(max_hp),
 		max_ap(max_ap),
 		hp(max_hp),
 		ap(max_ap),
 		abilities(abilities),
-		team(team)
+		team(team) {}
+
+	Mob::Mob(MobTable& table, int index) : max_hp(table.max_hp_[index]),
+		max_ap(table.max_ap_[index]),
+		hp(table.hp_[index]),
+		ap(table.ap_[index]),
+		abilities(table.abilities_[index]),
+		c(table.c_[index]),
+		team(table.team_[index]),
+		index(index),
+		generation(table.generation_[index]) {}
+
+	bool Mob::use_ability(int ability, Target target)
 	{
-		assert(abilities.size() == ABILITY_COUNT);
-	}
-
-	bool Mob::use_ability(int index, Target target)
-	{
-		assert(index <= abilities.size());
-
-		auto& ability = abilities[index];
-		return ap >= ability.cost;
+		assert(ability < ABILITY_COUNT);
+		return ap >= abilities[ability].cost;
 	}
 
 	void Mob::move(GameInstance& game, Coord d)
 	{
 		auto& arena = game.arena;
 		auto new_coord = c + d;
-		if (arena.is_valid_coord(new_coord) && !game.info.mob_at(new_coord)) {
-			int cost = arena.paths(c).distance + 1;
+		if (arena.is_valid_coord(new_coord) && !game.info.occupied(new_coord)) {
+			int cost = arena.move_cost(new_coord);
 
 			if (cost <= ap) {
 				fmt::printf("Moving for %d AP\n", cost);
-				c = c + d;
-				ap -= cost; // TODO - better calculation
+				game.state.apply(Action::move(id(), new_coord));
 			}
 		}
 	}
 
-	bool Mob::can_use_ability_at(Target t, PlayerInfo& info, Arena& arena, Ability ability)
+	bool Mob::can_use_ability_at(Target t, GameInstance& game, const Ability& ability)
 	{
-		bool within_range = ability.range >= arena.paths(t.c).distance;
+		assert(ability.range <= MAX_ABILITY_RANGE);
+
 		int distance = hex_distance(t.c, c);
-		within_range = distance <= ability.range;
+		bool within_range = distance <= ability.range;
 
-		return ability.cost <= ap && within_range;
+		return ability.cost <= ap && within_range && line_of_sight(game.state.hexes, c, t.c);
 	}
 
-	Mob::abilities_t Mob::usable_abilities(Target t, PlayerInfo& info, Arena& arena)
+	std::vector<Ability> Mob::usable_abilities(Target t, GameInstance& game)
 	{
-		abilities_t res;
+		std::vector<Ability> res;
 
 		for (auto&& ability : abilities) {
-			if (can_use_ability_at(t, info, arena, ability)) {
+			if (can_use_ability_at(t, game, ability)) {
 				res.push_back(ability);
 			}
 		}
@@ -375,29 +931,171 @@ namespace model {
 		return res;
 	}
 
-	PlayerInfo::PlayerInfo(std::size_t size) : size(size) {}
+	MobTable& MobTable::operator=(const MobTable& other)
+	{
+		if (this == &other) return *this;
+
+		size_ = other.size_;
+		std::copy_n(other.max_hp_.begin(), size_, max_hp_.begin());
+		std::copy_n(other.max_ap_.begin(), size_, max_ap_.begin());
+		std::copy_n(other.hp_.begin(), size_, hp_.begin());
+		std::copy_n(other.ap_.begin(), size_, ap_.begin());
+		std::copy_n(other.abilities_.begin(), size_, abilities_.begin());
+		std::copy_n(other.c_.begin(), size_, c_.begin());
+		std::copy_n(other.team_.begin(), size_, team_.begin());
+		std::copy_n(other.generation_.begin(), size_, generation_.begin());
+		next_generation_ = other.next_generation_;
+
+		return *this;
+	}
+
+	Mob MobTable::push_back(const MobData& mob)
+	{
+		assert(size_ < MAX_MOBS);
+
+		std::size_t i = size_++;
+		max_hp_[i] = mob.max_hp;
+		max_ap_[i] = mob.max_ap;
+		hp_[i] = mob.hp;
+		ap_[i] = mob.ap;
+		abilities_[i] = mob.abilities;
+		c_[i] = mob.c;
+		team_[i] = mob.team;
+		generation_[i] = next_generation_++;
+
+		return Mob(*this, static_cast<int>(i));
+	}
+
+	PlayerInfo::PlayerInfo(std::size_t size) : occupancy_(size, -1), size(size) {}
+
+	Mob PlayerInfo::add_mob(const MobData& mob)
+	{
+		assert(!occupied(mob.c));
+
+		auto added = mobs.push_back(mob);
+		if (mob.hp > 0) {
+			occupancy_(mob.c) = added.index;
+		}
+		occupancy_version_++;
+
+		auto index = static_cast<std::uint32_t>(added.index);
+		hash_ ^= zobrist_key(ZobristFeature::MobCoord, index, mob.c) ^
+			zobrist_key(ZobristFeature::MobHp, index, mob.hp) ^
+			zobrist_key(ZobristFeature::MobAp, index, mob.ap);
+
+		return added;
+	}
+
+	boost::optional<Mob> PlayerInfo::mob_at(Coord c)
+	{
+		if (!occupied(c)) {
+			return boost::none;
+		}
+
+		return mobs[occupancy_(c)];
+	}
+
+	boost::optional<Mob> PlayerInfo::mob(MobId id)
+	{
+		if (!mobs.contains(id)) {
+			return boost::none;
+		}
+
+		return mobs[id];
+	}
 
-	Mob& PlayerInfo::add_mob(Mob mob)
+	bool PlayerInfo::occupied(Coord c) const
 	{
-		mobs.push_back(mob);
-		return mobs.back();
+		return mob_index_at(c) >= 0;
 	}
 
-	Mob* PlayerInfo::mob_at(Coord c)
+	int PlayerInfo::mob_index_at(Coord c) const
 	{
-		for (auto& m : mobs) {
-			if (m.c == c) {
-				return &m;
+		return occupancy_.contains(c) ? occupancy_(c) : -1;
+	}
+
+	void PlayerInfo::move_mob(Mob mob, Coord c)
+	{
+		if (c == mob.c) return;
+		assert(!occupied(c));
+
+		if (mob.hp > 0) {
+			occupancy_(c) = occupancy_(mob.c);
+			occupancy_(mob.c) = -1;
+		}
+
+		auto index = static_cast<std::uint32_t>(mob.index);
+		hash_ ^= zobrist_key(ZobristFeature::MobCoord, index, mob.c) ^ zobrist_key(ZobristFeature::MobCoord, index, c);
+
+		mob.c = c;
+		occupancy_version_++;
+	}
+
+	void PlayerInfo::damage_mob(Mob mob, int d_hp)
+	{
+		if (mob.hp <= 0) return;
+
+		set_hp(mob, std::max(0, mob.hp - d_hp));
+	}
+
+	void PlayerInfo::set_hp(Mob mob, int hp)
+	{
+		bool was_alive = mob.hp > 0;
+
+		auto index = static_cast<std::uint32_t>(mob.index);
+		hash_ ^= zobrist_key(ZobristFeature::MobHp, index, mob.hp) ^ zobrist_key(ZobristFeature::MobHp, index, hp);
+		mob.hp = hp;
+
+		if (was_alive != (hp > 0)) {
+			if (hp > 0) {
+				assert(!occupied(mob.c));
+				occupancy_(mob.c) = mob.index;
+			} else {
+				occupancy_(mob.c) = -1;
+			}
+			occupancy_version_++;
+		}
+	}
+
+	void PlayerInfo::set_ap(Mob mob, int ap)
+	{
+		auto index = static_cast<std::uint32_t>(mob.index);
+		hash_ ^= zobrist_key(ZobristFeature::MobAp, index, mob.ap) ^ zobrist_key(ZobristFeature::MobAp, index, ap);
+		mob.ap = ap;
+	}
+
+	bool PlayerInfo::check_occupancy() const
+	{
+		std::size_t occupied = 0;
+
+		for (std::size_t i = 0; i < mobs.size(); ++i) {
+			if (mobs.hp(i) <= 0) continue;
+
+			auto c = mobs.c(i);
+			if (occupancy_(c) != static_cast<int>(i)) {
+				fmt::printf("ERROR - mob %d at %d,%d is missing from the occupancy grid\n", i, c.x, c.y);
+				return false;
 			}
+			occupied++;
 		}
 
-		return nullptr;
+		auto stale = std::count_if(occupancy_.begin(), occupancy_.end(), [](int i) { return i >= 0; });
+		if (static_cast<std::size_t>(stale) != occupied) {
+			fmt::printf("ERROR - occupancy grid has %d mobs, %d are alive\n", stale, occupied);
+			return false;
+		}
+
+		return true;
 	}
 
-	Index<Team> PlayerInfo::register_team(Player& player) {
+	std::size_t PlayerInfo::memory() const {
+		return occupancy_.memory() + teams.capacity() * sizeof(Team);
+	}
+
+	int PlayerInfo::register_team(Player& player) {
 		int id = static_cast<int>(teams.size());
 		teams.emplace_back(id, player);
-		return Index<Team>(teams, id);
+		return id;
 	}
 
 	Team& PlayerInfo::team_id(int id) {
@@ -405,9 +1103,14 @@ namespace model {
 		return teams[id];
 	}
 
-	boost::optional<Target> PlayerInfo::can_attack(Mob& player, Coord c)
+	const Team& PlayerInfo::team_id(int id) const {
+		assert(id < teams.size());
+		return teams[id];
+	}
+
+	boost::optional<Target> PlayerInfo::can_attack(Mob player, Coord c)
 	{
-		if (Mob* mob = mob_at(c)) {
+		if (auto mob = mob_at(c)) {
 			if (player.team != mob->team) {
 				return Target(c, *mob);
 			} else {
@@ -418,104 +1121,134 @@ namespace model {
 		}
 	}
 
-	Turn GameInstance::start_turn()
+	Turn& GameInstance::start_turn()
 	{
-		for (auto&& mob : info.mobs) {
-			mob.ap = std::min(mob.max_ap, mob.ap + mob.max_ap);
+		assert(info.check_occupancy());
+
+		state.start_turn();
+		mob_paths.compute(arena, info);
+
+		return state.turn;
+	}
+
+	const DistanceField& GameInstance::enemy_field(const Team& team)
+	{
+		while (enemy_fields_.size() <= static_cast<std::size_t>(team.id())) {
+			enemy_fields_.emplace_back(size);
 		}
 
-		return Turn(info.mobs);
+		auto& field = enemy_fields_[team.id()];
+
+		if (!field.computed ||
+			field.terrain_version != arena.terrain_version() ||
+			field.occupancy_version != info.occupancy_version()) {
+			seeds_.clear();
+
+			for (std::size_t i = 0; i < info.mobs.size(); ++i) {
+				if (info.mobs.hp(i) > 0 && info.mobs.team(i) != team.id()) {
+					seeds_.push_back({ info.mobs.c(i), static_cast<int>(i) });
+				}
+			}
+
+			field.compute(arena, info, seeds_);
+		}
+
+		return field;
 	}
 
 	void TurnManager::update_arena(Arena& arena)
 	{
 		assert(!current_turn.is_done());
-		auto& player = **current_turn.current_;
-
 		// TODO - update this
-		arena.dijkstra(player.c, info_);
+		arena.dijkstra(info_.mobs.c(current_turn.current().index), info_);
+#ifndef HEXMAGE_HEADLESS
 		arena.regenerate_geometry();
+#endif
 	}
 
-	Mob* TurnManager::current_mob() const
+	boost::optional<Mob> TurnManager::current_mob() const
 	{
 		if (current_turn.is_done())
-			return nullptr;
+			return boost::none;
 		else
-			return *current_turn.current_;
+			return info_.mobs[current_turn.current()];
 	}
 
-	void UserPlayer::action_to(Coord click_hex, GameInstance& game, Mob& current_mob)
+	boost::optional<Mob> TurnManager::next_mob()
 	{
-		auto path = game.arena.paths(click_hex);
+		auto next = current_turn.next(info_);
+		if (next.is_none())
+			return boost::none;
+		else
+			return info_.mobs[next];
+	}
 
+	void UserPlayer::action_to(Coord click_hex, GameInstance& game, Mob current_mob)
+	{
 		if (auto target = game.info.can_attack(current_mob, click_hex)) {
-			auto abilities = current_mob.usable_abilities(*target, game.info, game.arena);
+			auto abilities = current_mob.usable_abilities(*target, game);
 
 			if (abilities.size() > 0) {
 				auto ability = abilities.back();
 				fmt::print("Using ability {}\n", ability);
 
-				current_mob.ap -= ability.cost;
-				target->mob.hp = std::max(0, target->mob.hp - ability.d_hp);
+				game.info.set_ap(current_mob, current_mob.ap - ability.cost);
+				game.info.damage_mob(target->mob, ability.d_hp);
 			}
 		}
-		else {
-			if (path.distance <= current_mob.ap) {
-				current_mob.ap -= path.distance;
-				current_mob.c = click_hex;
+		// The oracle ignores mobs, so a hex it already puts out of reach doesn't need a flood fill.
+		else if (game.distances.distance(current_mob.c, click_hex) <= current_mob.ap) {
+			int distance = game.mob_paths.of(current_mob, game.arena, game.info).distance(click_hex);
+
+			if (distance <= current_mob.ap) {
+				game.info.set_ap(current_mob, current_mob.ap - distance);
+				game.info.move_mob(current_mob, click_hex);
 			}
 		}
 	}
 
-	void UserPlayer::any_action(GameInstance& game, Mob& mob)
+	void UserPlayer::any_action(GameInstance& game, Mob mob)
 	{
 		fmt::printf("TODO - what should this actually do?");
 	}
 
-	void AIPlayer::action_to(Coord c, GameInstance& game, Mob& mob)
+	void AIPlayer::action_to(Coord c, GameInstance& game, Mob mob)
 	{
 		// TODO - basic AI		
 	}
 
-	void AIPlayer::any_action(GameInstance& game, Mob& mob)
+	void AIPlayer::any_action(GameInstance& game, Mob mob)
 	{
-		std::vector<Mob*> enemies;
-		for (auto&& enemy : game.info.mobs) {
-			if (enemy.team != mob.team && enemy.hp > 0) {
-				enemies.push_back(&enemy);
-			}
-		}
-
-		if (enemies.size() > 0) {
-			auto distance_f = [&mob](Mob* a, Mob* b) {
-				return hex_distance(mob.c, a->c) < hex_distance(mob.c, b->c);
-			};
+		auto& field = game.enemy_field(game.info.team_id(mob.team));
+		int nearest = field.nearest(mob.c);
 
-			std::sort(enemies.begin(), enemies.end(), distance_f);
-
-			auto&& enemy = *enemies[0];
+		if (nearest >= 0) {
+			auto enemy = game.info.mobs[nearest];
 			auto c = enemy.c;
 
-			auto abilities = mob.usable_abilities(
-				Target(c, enemy),
-				game.info,
-				game.arena);
+			auto abilities = mob.usable_abilities(Target(c, enemy), game);
 
 			if (abilities.empty()) {
 				fmt::print("DEBUG - no abilities available, moving instead\n");
-				// no ability is in rage, we have to move
-				auto dis = (c - mob.c);
-				auto dx = dis.abs().x;
-				if (!dx) dx = 1;
-
-				auto dy = dis.abs().y;
-				if (!dy) dy = 1;
-
-				// TODO - the offset is wrong when going bottom-left
-				Coord off{ dis.x / dx, dis.y / dy };
+				// No ability is in range, move to the hex closest to the enemies
+				// that the AP allow. The cells are sorted by cost, so on ties
+				// the cheapest way there wins.
+				game.arena.use_paths(mob.c, game.mob_paths.of(mob, game.arena, game.info));
+				game.arena.reachable_cells(mob, reachable_);
+
+				const Reachable* best = nullptr;
+				int best_distance = field.distance(mob.c);
+				for (auto& cell : reachable_) {
+					if (field.distance(cell.c) < best_distance) {
+						best = &cell;
+						best_distance = field.distance(cell.c);
+					}
+				}
 
-				mob.move(game, off);
+				if (best) {
+					game.info.set_ap(mob, mob.ap - best->cost);
+					game.info.move_mob(mob, best->c);
+				}
 
 			} else {
 				// TODO - use a random ability for now
@@ -524,37 +1257,81 @@ namespace model {
 
 		} else {
 			// TODO - logging
-			fmt::print("INFO - All enemies are dead\n");
+			fmt::print("INFO - All enemies are dead or out of reach\n");
+
+			// Wander off somewhere with half the AP, enemies walled off now
+			// may be reachable from elsewhere once the terrain changes.
+			game.arena.use_paths(mob.c, game.mob_paths.of(mob, game.arena, game.info));
+			game.arena.reachable_cells(mob, reachable_);
+
+			if (reachable_.count_within(mob.ap / 2) > 0) {
+				auto& cell = reachable_.sample(thread_rng(), mob.ap / 2);
+				game.info.set_ap(mob, mob.ap - cell.cost);
+				game.info.move_mob(mob, cell.c);
+			}
 		}
 		
 	}
 
-	Turn::Turn(std::vector<Mob>& mobs)
+	Turn::Turn(const MobTable& mobs)
+	{
+		reset(mobs);
+	}
+
+	void Turn::reset(const MobTable& mobs)
 	{
-		for (auto&& mob : mobs) {
-			mobs_.push_back(&mob);
+		order_.clear();
+		current_ = 0;
+
+		for (std::size_t i = 0; i < mobs.size(); ++i) {
+			order_.push_back(mobs.id(i));
 		}
 
-		std::sort(mobs_.begin(), mobs_.end(),
-			[](auto x, auto y) { return x->ap < y->ap; });
+		std::sort(order_.begin(), order_.end(),
+			[&](MobId x, MobId y) { return mobs.ap(x.index) < mobs.ap(y.index); });
+
+		rehash_order();
+	}
+
+	void Turn::rehash_order()
+	{
+		order_hash_ = 0;
+		for (std::size_t i = 0; i < order_.size(); ++i) {
+			order_hash_ ^= zobrist_key(ZobristFeature::TurnOrder, static_cast<std::uint32_t>(i), order_[i].index);
+		}
+	}
 
-		current_ = mobs_.begin();
+	MobId Turn::current() const
+	{
+		assert(!is_done());
+		return order_[current_];
 	}
 
-	Mob* Turn::next()
+	MobId Turn::next(const PlayerInfo& info)
 	{
-		if (current_ == mobs_.end()) return nullptr;
+		if (is_done()) return MobId();
 
 		while (true) {
 			++current_;
-			if (current_ == mobs_.end()) {
-				return nullptr;
+			if (is_done()) {
+				return MobId();
 			}
 
-			if ((**current_).hp > 0) return *current_;
+			auto id = order_[current_];
+			if (info.mobs.contains(id) && info.mobs.hp(id.index) > 0) return id;
 		}
 	}
 
+	bool Turn::is_last(const PlayerInfo& info) const
+	{
+		for (std::size_t i = current_ + 1; i < order_.size(); ++i) {
+			auto id = order_[i];
+			if (info.mobs.contains(id) && info.mobs.hp(id.index) > 0) return false;
+		}
+
+		return true;
+	}
+
 	Color color_for_type(HexType type) {
 		switch (type) {
 		case HexType::Empty:
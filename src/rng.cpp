@@ -0,0 +1,24 @@
+#include <atomic>
+#include <rng.hpp>
+
+namespace model
+{
+	namespace
+	{
+		std::atomic<std::uint64_t> master_seed_{ 0 };
+		std::atomic<std::uint64_t> next_thread_{ 0 };
+	}
+
+	std::uint64_t master_seed() {
+		return master_seed_;
+	}
+
+	void set_master_seed(std::uint64_t seed) {
+		master_seed_ = seed;
+	}
+
+	Rng& thread_rng() {
+		thread_local Rng rng(master_seed_, next_thread_++);
+		return rng;
+	}
+}
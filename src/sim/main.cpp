@@ -0,0 +1,38 @@
+// Command line front end of the rules engine, built without SDL, GL or
+// FreeType by the hexmage_sim target, so that batch simulations and
+// benchmarks can run on machines without a display.
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <simulation.hpp>
+
+int main(int argc, char** argv) {
+	const char* command = argc > 1 ? argv[1] : "simulate";
+
+	// Number of games and the master seed everything is derived from, the
+	// same seed plays the same games, on any number of cores for the farm.
+	std::size_t games = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 100000;
+	std::uint64_t seed = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 0;
+	model::set_master_seed(seed);
+
+	if (std::strcmp(command, "simulate") == 0) {
+		simulation::DummySimulation sim;
+		sim.run(games);
+	} else if (std::strcmp(command, "farm") == 0) {
+		simulation::PlayoutFarm farm(simulation::DummySimulation::starting_position(10, 5, model::Rng(seed).split(0)), seed);
+		farm.run(games);
+	} else if (std::strcmp(command, "profile") == 0) {
+		simulation::dummy_profiling();
+
+		for (auto& result : simulation::profiling_results) {
+			std::cout << result << std::endl;
+		}
+	} else {
+		std::cerr << "Usage: " << argv[0] << " [simulate|farm|profile] [games] [seed]" << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -1,43 +1,192 @@
+#include <cstring>
 #include <simulation.hpp>
 #include <format.h>
+#include <worker_pool.hpp>
 
 namespace simulation
 {
 
 	std::vector<std::string> profiling_results;
 
+	namespace
+	{
+		using namespace model;
+
+		// Playouts only go through GameState, the teams just need someone to belong to.
+		AIPlayer playout_player;
+
+
+		// How Matrix used to store arena data, a (2 size + 1)^2 grid indexed row by row.
+		struct PaddedLayout
+		{
+			static std::size_t capacity(std::size_t size) { return (2 * size + 1) * (2 * size + 1); }
+			static std::size_t index(Coord c, std::size_t size) { return c.y * (2 * size + 1) + c.x; }
+		};
+
+		// Fastest times seen for a layout, see layout_benchmark.
+		struct LayoutTimes
+		{
+			float bfs_ms = std::numeric_limits<float>::max();
+			float geometry_ms = std::numeric_limits<float>::max();
+			std::size_t memory = 0;
+		};
+
+		// Flood fills and geometry rebuilds over copies of the arena stored in
+		// `Layout`, keeping the faster times in `best`.
+		template <typename Layout>
+		void layout_benchmark(const Arena& arena, int iterations, LayoutTimes& best) {
+			std::size_t size = arena.size;
+			int isize = static_cast<int>(size);
+
+			HexGrid<HexType, Layout> hexes(size);
+			HexGrid<int, Layout> distances(size);
+			HexGrid<Position, Layout> positions(size);
+
+			for (int y = 0; y < isize; ++y) {
+				for (int x = 0; x < isize; ++x) {
+					hexes({ x, y }) = arena.hexes({ x, y });
+				}
+			}
+
+			std::vector<Coord> queue;
+			Coord start(isize / 2, isize / 2);
+
+			Stopwatch ss;
+			for (int i = 0; i < iterations; ++i) {
+				distances.fill(std::numeric_limits<int>::max());
+				queue.clear();
+
+				distances(start) = 0;
+				queue.push_back(start);
+
+				for (std::size_t q = 0; q < queue.size(); ++q) {
+					Coord current = queue[q];
+					int next = distances(current) + 1;
+
+					for (auto neighbour : hexes.neighbours(current)) {
+						if (hexes(neighbour) == HexType::Wall || distances(neighbour) <= next) continue;
+
+						distances(neighbour) = next;
+						queue.push_back(neighbour);
+					}
+				}
+			}
+			float bfs_ms = ss.ms_f();
+
+			ss.start();
+			for (int i = 0; i < iterations; ++i) {
+				for (int y = 0; y < isize; ++y) {
+					for (int x = 0; x < isize; ++x) {
+						positions({ x, y }) = arena.hex_center({ x, y });
+					}
+				}
+			}
+			float geometry_ms = ss.ms_f();
+
+			best.bfs_ms = std::min(best.bfs_ms, bfs_ms);
+			best.geometry_ms = std::min(best.geometry_ms, geometry_ms);
+			best.memory = hexes.memory() + distances.memory() + positions.memory();
+		}
+
+		// Puts `walls` walls and `mud` mud hexes on random hexes of `state`, some
+		// of which may land on the same hex. Goes through set_hex and
+		// set_move_cost, so the hash and the terrain version stay current.
+		void scatter_terrain(GameState& state, Rng& gen, int walls, int mud) {
+			std::uniform_int_distribution<int> coord_dis(0, static_cast<int>(state.size) - 1);
+
+			for (int i = 0; i < std::max(walls, mud); ++i) {
+				if (i < mud) {
+					state.set_move_cost({ coord_dis(gen), coord_dis(gen) }, MUD_MOVE_COST);
+				}
+				if (i < walls) {
+					state.set_hex({ coord_dis(gen), coord_dis(gen) }, HexType::Wall);
+				}
+			}
+		}
+
+		// Whether two states agree on everything an action can change.
+		bool same_state(const GameState& a, const GameState& b) {
+			if (a.info.mobs.size() != b.info.mobs.size()) return false;
+
+			for (std::size_t i = 0; i < a.info.mobs.size(); ++i) {
+				if (a.info.mobs.hp(i) != b.info.mobs.hp(i) ||
+				    a.info.mobs.ap(i) != b.info.mobs.ap(i) ||
+				    a.info.mobs.c(i) != b.info.mobs.c(i)) {
+					return false;
+				}
+			}
+
+			return a.turn.order() == b.turn.order() &&
+				a.turn.cursor() == b.turn.cursor() &&
+				a.hash() == b.hash() &&
+				a.info.check_occupancy();
+		}
+
+		// FNV-1a over everything GameState::hash covers, as an independent second
+		// hash to tell Zobrist collisions apart from states that are really equal.
+		std::uint64_t fingerprint(const GameState& state) {
+			std::uint64_t h = 14695981039346656037ull;
+			auto add = [&](int value) {
+				h = (h ^ static_cast<std::uint32_t>(value)) * 1099511628211ull;
+			};
+
+			for (auto type : state.hexes) add(static_cast<int>(type));
+			for (auto cost : state.move_costs) add(cost);
+
+			for (std::size_t i = 0; i < state.info.mobs.size(); ++i) {
+				add(state.info.mobs.c(i).x);
+				add(state.info.mobs.c(i).y);
+				add(state.info.mobs.hp(i));
+				add(state.info.mobs.ap(i));
+			}
+
+			for (auto id : state.turn.order()) add(id.index);
+			add(static_cast<int>(state.turn.cursor()));
+
+			return h;
+		}
+	}
+
 	void dummy_profiling() {
 		using namespace model;
 		profiling_results.clear();
 
 		GameInstance g(30);
-//		g.info.add_mob(generator::random_mob());
-//		g.info.add_mob(generator::random_mob());
-//		g.info.add_mob(generator::random_mob());
-//		g.info.add_mob(generator::random_mob());
-//		g.info.add_mob(generator::random_mob());
-//		g.info.add_mob(generator::random_mob());
-//		g.info.add_mob(generator::random_mob());
-//		g.info.add_mob(generator::random_mob());
-//		g.info.add_mob(generator::random_mob());
-//		g.info.add_mob(generator::random_mob());
+		AIPlayer ai_player;
+		Rng mob_gen(0);
 
 		Stopwatch ss;
+		std::string str;
 
-		//int iterations = 100000;
+		// The rules state copies without touching GL, the way a search would
+		// branch off from the current position. Assigning to a state that has
+		// been used before reuses its buffers.
+		{
+			auto state = DummySimulation::starting_position(20, 5, mob_gen.split(1));
 
-		//std::size_t total_size = 0;
+			int iterations = 1000000;
+			std::size_t total_mobs = 0;
 
-		//ss.start();
-		//for (int i = 0; i < iterations; i++) {
-		//	auto r = g;
-		//	total_size += r.size;
-		//}
+			ss.start();
+			for (int i = 0; i < iterations; i++) {
+				GameState copy = state;
+				total_mobs += copy.info.mobs.size();
+			}
+			float copy_ms = ss.ms_f();
 
-		std::string str;
-		//str = fmt::sprintf("GameInstance copy iterations %d took %dms\t%fus", iterations, ss.ms(), ((float)ss.ms()) / iterations * 1000);
-		str = fmt::sprintf("!!!!!!!!! GAME INSTANCE COPYING DISABLED, BENCHMARK NOT RUN !!!!!!!!!");
-		profiling_results.push_back(str);
+			GameState reused = state;
+			ss.start();
+			for (int i = 0; i < iterations; i++) {
+				reused = state;
+				total_mobs += reused.info.mobs.size();
+			}
+			float assign_ms = ss.ms_f();
+
+			str = fmt::sprintf("GameState size %d with %d mobs, %d bytes: copy %fus, assign %fus (%d)",
+			                   state.size, state.info.mobs.size(), state.memory(),
+			                   copy_ms / iterations * 1000, assign_ms / iterations * 1000, total_mobs);
+			profiling_results.push_back(str);
+		}
 
 		PlayerInfo ifo = g.info;
 
@@ -53,60 +202,883 @@ namespace simulation
 		str = fmt::sprintf("PlayerInfo copy iterations %d took %dms\t%fus", info_iterations, ss.ms(), ((float)ss.ms()) / info_iterations * 1000);
 		profiling_results.push_back(str);
 
+		// The mobs alone copy without allocating, compared to a plain memcpy
+		// of the same number of bytes.
+		{
+			MobTable source, mobs;
+			while (source.size() < 10) {
+				source.push_back(generator::random_mob(source.size() < 5 ? 0 : 1, 20, mob_gen));
+			}
+
+			std::size_t bytes = source.size() * (5 * sizeof(int) + sizeof(Coord) + sizeof(MobData::abilities_t));
+			std::vector<char> from(bytes), to(bytes);
+
+			ss.start();
+			for (int i = 0; i < info_iterations; ++i) {
+				mobs = source;
+				total_mobs += mobs.size();
+			}
+			float table_ms = ss.ms_f();
+
+			ss.start();
+			for (int i = 0; i < info_iterations; ++i) {
+				std::memcpy(to.data(), from.data(), bytes);
+				total_mobs += to[i % bytes];
+			}
+			float memcpy_ms = ss.ms_f();
+
+			str = fmt::sprintf("MobTable copy of %d mobs %fus, memcpy of %d bytes %fus (%d)",
+			                   source.size(), table_ms / info_iterations * 1000,
+			                   bytes, memcpy_ms / info_iterations * 1000, total_mobs);
+			profiling_results.push_back(str);
+		}
+
+		// With the occupancy grid, adding mobs shouldn't make dijkstra any slower.
+		auto team = g.info.register_team(ai_player);
+
+		int dijkstra_iterations = 10000;
+		for (std::size_t mob_count : { 1, 10, 50, 200 }) {
+			while (g.info.mobs.size() < mob_count) {
+				auto mob = generator::random_mob(team, g.size, mob_gen);
+				if (!g.info.mob_at(mob.c)) {
+					g.info.add_mob(mob);
+				}
+			}
+
+			ss.start();
+			for (int i = 0; i < dijkstra_iterations; ++i) {
+				g.arena.dijkstra(g.info.mobs[0].c, g.info);
+			}
+
+			str = fmt::sprintf("dijkstra with %d mobs, iterations %d took %dms\t%fus", mob_count, dijkstra_iterations, ss.ms(), ((float)ss.ms()) / dijkstra_iterations * 1000);
+			profiling_results.push_back(str);
+		}
+
+		// Mixed terrain costs go through the same bucket queue and should cost about the same.
+		std::vector<Coord> changed;
+		for (int y = 0; y < static_cast<int>(g.size); ++y) {
+			for (int x = 0; x < static_cast<int>(g.size); x += 3) {
+				g.arena.set_move_cost({ x, y }, MUD_MOVE_COST, g.info, changed);
+			}
+		}
+
+		ss.start();
+		for (int i = 0; i < dijkstra_iterations; ++i) {
+			g.arena.dijkstra(g.info.mobs[0].c, g.info);
+		}
+
+		str = fmt::sprintf("dijkstra with mud, iterations %d took %dms\t%fus", dijkstra_iterations, ss.ms(), ((float)ss.ms()) / dijkstra_iterations * 1000);
+		profiling_results.push_back(str);
+
+		// The hexes a mob can move to, read off its flood fill, have to be exactly
+		// the ones within its AP, sorted by cost, and a sample for k AP can't
+		// pick a hex that costs more.
+		{
+			Rng sample_gen(0);
+			ReachableCells cells;
+			std::size_t total_cells = 0;
+			float cells_ms = 0;
+			int mismatches = 0;
+
+			for (std::size_t i = 0; i < 50; ++i) {
+				auto mob = g.info.mobs[i];
+				int ap = mob.ap;
+				g.info.set_ap(mob, static_cast<int>(i) % (MAX_AP + 1));
+				g.arena.dijkstra(mob.c, g.info);
+
+				ss.start();
+				g.arena.reachable_cells(mob, cells);
+				cells_ms += ss.ms_f();
+				total_cells += cells.size();
+
+				std::size_t expected = 0;
+				for (int y = 0; y < static_cast<int>(g.size); ++y) {
+					for (int x = 0; x < static_cast<int>(g.size); ++x) {
+						if (Coord(x, y) != mob.c && g.arena.path({ x, y }).distance <= mob.ap) {
+							expected++;
+						}
+					}
+				}
+
+				if (cells.size() != expected) mismatches++;
+
+				for (std::size_t j = 0; j < cells.size(); ++j) {
+					if (cells[j].cost != g.arena.path(cells[j].c).distance ||
+					    (j > 0 && cells[j].cost < cells[j - 1].cost)) {
+						mismatches++;
+					}
+				}
+
+				for (int cost = 0; cost <= mob.ap; ++cost) {
+					auto within = std::count_if(cells.begin(), cells.end(), [&](const Reachable& r) { return r.cost <= cost; });
+					if (cells.count_within(cost) != static_cast<std::size_t>(within)) {
+						mismatches++;
+					}
+
+					for (int k = 0; within > 0 && k < 10; ++k) {
+						if (cells.sample(sample_gen, cost).cost > cost) {
+							mismatches++;
+						}
+					}
+				}
+
+				g.info.set_ap(mob, ap);
+			}
+
+			str = fmt::sprintf("reachable cells of 50 mobs, %d hexes, %fus per mob, mismatches: %d",
+			                   total_cells, cells_ms / 50 * 1000, mismatches);
+			profiling_results.push_back(str);
+		}
+
+		// Stress test on growing arenas with some walls and mud scattered around,
+		// the frontier and with it the queue should stay small.
+		for (int arena_size : { 20, 50, 100, 200, 500, 1000 }) {
+			GameState state(arena_size);
+			Arena arena(state);
+			PlayerInfo& empty_info = state.info;
+
+			Rng terrain_gen(0);
+			scatter_terrain(state, terrain_gen, arena_size * arena_size / 16, arena_size * arena_size / 16);
+
+			Coord center(arena_size / 2, arena_size / 2);
+			arena.hexes(center) = HexType::Empty;
+
+			int iterations = std::max(1, 2000000 / (arena_size * arena_size));
+
+			ss.start();
+			for (int i = 0; i < iterations; ++i) {
+				arena.dijkstra(center, empty_info);
+			}
+			float stress_ms = ss.ms_f();
+
+			std::size_t reached = 0;
+			for (int y = 0; y < arena_size; ++y) {
+				for (int x = 0; x < arena_size; ++x) {
+					if (arena.path({ x, y }).distance != std::numeric_limits<int>::max()) {
+						reached++;
+					}
+				}
+			}
+
+			str = fmt::sprintf("dijkstra stress size %d, %d hexes reached, %f Mnodes/s, frontier peak %d, memory %fMB",
+			                   arena_size, reached, reached * iterations / (stress_ms * 1000.0f), arena.frontier_peak(),
+			                   arena.path_memory() / (1024.0f * 1024.0f));
+			profiling_results.push_back(str);
+		}
+
+		// The oracle against a flood fill from every hex, with 8 and 16 bit all
+		// pairs tables and with rows on demand for an arena too large for them.
+		// Changing the terrain has to be picked up by the next query.
+		for (int arena_size : { 7, 20, 60 }) {
+			GameState state(arena_size);
+			Arena arena(state);
+			DistanceOracle oracle(arena);
+
+			Rng terrain_gen(0);
+			scatter_terrain(state, terrain_gen, arena_size * arena_size / 8, arena_size * arena_size / 8);
+
+			ss.start();
+			oracle.distance({ 0, 0 }, { 0, 0 });
+			float build_ms = ss.ms_f();
+
+			PathTree tree(arena_size);
+			BucketQueue queue(MAX_MOVE_COST + MIN_MOVE_COST, arena_size);
+			std::size_t queries = 0;
+			int mismatches = 0;
+			float query_ms = 0;
+
+			for (int edit = 0; edit < 2; ++edit) {
+				for (int y = 0; y < arena_size; y += edit + 1) {
+					for (int x = 0; x < arena_size; x += edit + 1) {
+						Coord from(x, y);
+						if (arena.hexes(from) == HexType::Wall) continue;
+
+						arena.flood_fill(from, state.info, tree, queue);
+
+						ss.start();
+						for (int ty = 0; ty < arena_size; ++ty) {
+							for (int tx = 0; tx < arena_size; ++tx) {
+								if (oracle.distance(from, { tx, ty }) != tree.distance({ tx, ty })) {
+									mismatches++;
+								}
+							}
+						}
+						query_ms += ss.ms_f();
+						queries += arena_size * arena_size;
+					}
+				}
+
+				state.set_move_cost({ arena_size / 2, arena_size / 2 }, MAX_MOVE_COST);
+				state.set_hex({ arena_size / 3, arena_size / 2 }, HexType::Wall);
+			}
+
+			str = fmt::sprintf("distance oracle size %d, %s: build %fms, %fns per query, mismatches: %d",
+			                   arena_size, oracle.precomputed() ? "all pairs" : "on demand",
+			                   build_ms, query_ms / queries * 1000000, mismatches);
+			profiling_results.push_back(str);
+		}
+
+		// Lines of sight between every pair of hexes in range, as is_legal and
+		// the game check them. Neighbours always see each other, and without
+		// walls everything in range is visible.
+		{
+			int arena_size = 20;
+			GameState state(arena_size);
+			HexGrid<HexType> open_hexes(arena_size, HexType::Empty);
+
+			Rng wall_gen(0);
+			scatter_terrain(state, wall_gen, arena_size * arena_size / 6, 0);
+
+			std::vector<std::pair<Coord, Coord>> pairs;
+			for (int y = 0; y < arena_size; ++y) {
+				for (int x = 0; x < arena_size; ++x) {
+					for (int i = 0; i < hex_area(MAX_ABILITY_RANGE); ++i) {
+						Coord to = Coord(x, y) + spiral_offsets[i];
+						if (state.is_valid_coord(to)) {
+							pairs.emplace_back(Coord(x, y), to);
+						}
+					}
+				}
+			}
+
+			std::size_t visible = 0;
+			ss.start();
+			for (auto& pair : pairs) {
+				visible += line_of_sight(state.hexes, pair.first, pair.second);
+			}
+			float line_ms = ss.ms_f();
+
+			int mismatches = 0;
+			for (auto& pair : pairs) {
+				if (!line_of_sight(open_hexes, pair.first, pair.second) ||
+				    (hex_distance(pair.first, pair.second) <= 1 && !line_of_sight(state.hexes, pair.first, pair.second))) {
+					mismatches++;
+				}
+			}
+
+			str = fmt::sprintf("line of sight %d pairs, %d visible: %fns per line, mismatches: %d",
+			                   pairs.size(), visible, line_ms / pairs.size() * 1000000, mismatches);
+			profiling_results.push_back(str);
+		}
+
+		// Long routes on a huge arena, through the cluster graph against A* over every hex.
+		{
+			int arena_size = 1000;
+			GameState state(arena_size);
+			Arena arena(state);
+			PlayerInfo& empty_info = state.info;
+
+			Rng terrain_gen(0);
+			scatter_terrain(state, terrain_gen, arena_size * arena_size / 16, arena_size * arena_size / 16);
+			std::uniform_int_distribution<int> coord_dis(0, arena_size - 1);
+
+			ClusterPaths clusters(arena);
+			std::vector<Coord> path;
+
+			ss.start();
+			clusters.plan({ 0, 0 }, { 0, 0 }, path);
+			float build_ms = ss.ms_f();
+
+			float cluster_ms = 0;
+			float flat_ms = 0;
+			double flat_cost = 0;
+			double cluster_cost = 0;
+			int routes = 0;
+
+			for (int i = 0; i < 50; ++i) {
+				Coord from(coord_dis(terrain_gen), coord_dis(terrain_gen));
+				Coord to(coord_dis(terrain_gen), coord_dis(terrain_gen));
+				if (arena.hexes(from) == HexType::Wall) continue;
+
+				ss.start();
+				bool found = clusters.find_path(from, to, path);
+				cluster_ms += ss.ms_f();
+
+				ss.start();
+				arena.find_path(from, to, std::numeric_limits<int>::max(), empty_info, path);
+				flat_ms += ss.ms_f();
+
+				if (found && !path.empty()) {
+					for (auto c : path) {
+						flat_cost += arena.move_cost(c);
+					}
+					cluster_cost += clusters.cost();
+					routes++;
+				}
+			}
+
+			Coord wall(arena_size / 2, arena_size / 2);
+			std::vector<Coord> changed;
+
+			ss.start();
+			arena.set_hex(wall, arena.hexes(wall) == HexType::Wall ? HexType::Empty : HexType::Wall, empty_info, changed);
+			clusters.invalidate(wall);
+			clusters.plan({ 0, 0 }, { 0, 0 }, path);
+			float edit_ms = ss.ms_f();
+
+			// A cluster the routes cross turns expensive without invalidate, then a
+			// single invalidated edit follows, which must not hide the first ones.
+			const int K = ClusterPaths::cluster_size;
+			for (int y = K; y < 2 * K; ++y) {
+				for (int x = K; x < 2 * K; ++x) {
+					state.set_move_cost({ x, y }, MAX_MOVE_COST);
+				}
+			}
+			arena.set_hex(wall, arena.hexes(wall) == HexType::Wall ? HexType::Empty : HexType::Wall, empty_info, changed);
+			clusters.invalidate(wall);
+
+			ClusterPaths rebuilt(arena);
+			int stale = 0;
+			for (int y = K; y < 2 * K; ++y) {
+				Coord from(K / 2, y);
+				Coord to(5 * K / 2, y);
+
+				bool found = clusters.find_path(from, to, path);
+				if (found != rebuilt.find_path(from, to, path) || (found && clusters.cost() != rebuilt.cost())) {
+					stale++;
+				}
+			}
+
+			str = fmt::sprintf("cluster paths size %d: %d entrances, build %fms, %fMB, %d routes %fms vs %fms flat, %f%% longer, wall edit %fms, %d stale after an edit without invalidate",
+			                   arena_size, clusters.entrance_count(), build_ms, clusters.memory() / (1024.0f * 1024.0f),
+			                   routes, cluster_ms / routes, flat_ms / routes, (cluster_cost / flat_cost - 1) * 100, edit_ms, stale);
+			profiling_results.push_back(str);
+		}
+
+		// The old padded Matrix layout against the compact HexGrid, at the size of
+		// the game's arena and a larger one. The layouts take turns and each keeps
+		// its best of a few rounds, so neither is penalised for running first.
+		for (int arena_size : { 30, 200 }) {
+			GameState state(arena_size);
+			Arena arena(state);
+			Rng wall_gen(0);
+			scatter_terrain(state, wall_gen, arena_size * arena_size / 16, 0);
+			arena.hexes({ arena_size / 2, arena_size / 2 }) = HexType::Empty;
+
+			int rounds = 5;
+			int iterations = 4000000 / (arena_size * arena_size);
+			LayoutTimes padded, row_major;
+
+			for (int round = 0; round < rounds; ++round) {
+				layout_benchmark<PaddedLayout>(arena, iterations, padded);
+				layout_benchmark<RowMajorLayout>(arena, iterations, row_major);
+			}
+
+			str = fmt::sprintf("layouts size %d, best of %d x %d iterations: padded bfs %fms, geometry %fms, %fMB; row major bfs %fms, geometry %fms, %fMB",
+			                   arena_size, rounds, iterations,
+			                   padded.bfs_ms, padded.geometry_ms, padded.memory / (1024.0f * 1024.0f),
+			                   row_major.bfs_ms, row_major.geometry_ms, row_major.memory / (1024.0f * 1024.0f));
+			profiling_results.push_back(str);
+		}
+
+		// One multi source search answers "closest enemy" for the whole team,
+		// instead of every mob sorting the enemies by distance on its own.
+		auto enemy_team = g.info.register_team(ai_player);
+		while (g.info.mobs.size() < 250) {
+			auto mob = generator::random_mob(enemy_team, g.size, mob_gen);
+			if (!g.info.mob_at(mob.c)) {
+				g.info.add_mob(mob);
+			}
+		}
+
+		std::vector<FieldSeed> seeds;
+		for (std::size_t i = 200; i < g.info.mobs.size(); ++i) {
+			seeds.push_back({ g.info.mobs[i].c, static_cast<int>(i) });
+		}
+
+		DistanceField field(g.size);
+		int field_iterations = 10000;
+		ss.start();
+		for (int i = 0; i < field_iterations; ++i) {
+			field.compute(g.arena, g.info, seeds);
+		}
+		float field_ms = ss.ms_f();
+
+		// Without mobs in the way, every hex has to be as far from its seed as
+		// the oracle says it is from the closest one.
+		PlayerInfo nobody(g.size);
+		DistanceField open_field(g.size);
+		open_field.compute(g.arena, nobody, seeds);
+
+		int field_mismatches = 0;
+		for (int y = 0; y < static_cast<int>(g.size); ++y) {
+			for (int x = 0; x < static_cast<int>(g.size); ++x) {
+				int closest = std::numeric_limits<int>::max();
+				for (auto& seed : seeds) {
+					closest = std::min(closest, g.distances.distance({ x, y }, seed.c));
+				}
+
+				int nearest = open_field.nearest({ x, y });
+				if (open_field.distance({ x, y }) != closest ||
+				    (nearest >= 0 && g.distances.distance({ x, y }, g.info.mobs.c(nearest)) != closest)) {
+					field_mismatches++;
+				}
+			}
+		}
+
+		str = fmt::sprintf("enemy field for %d seeds, iterations %d took %fms\t%fus, mismatches: %d",
+		                   seeds.size(), field_iterations, field_ms, field_ms / field_iterations * 1000, field_mismatches);
+		profiling_results.push_back(str);
+
+		// The per mob searches at the start of a turn are independent of each
+		// other, so they run on the worker pool instead of one after another.
+		int turn_iterations = 20;
+		ss.start();
+		for (int i = 0; i < turn_iterations; ++i) {
+			for (auto mob : g.info.mobs) {
+				g.arena.dijkstra(mob.c, g.info);
+			}
+		}
+		float serial_ms = ss.ms_f();
+
+		ss.start();
+		for (int i = 0; i < turn_iterations; ++i) {
+			MobPaths mob_paths;
+			mob_paths.compute(g.arena, g.info);
+		}
+		float pool_ms = ss.ms_f();
+
+		str = fmt::sprintf("turn start paths for %d mobs: serial %fms, pool of %d threads %fms",
+		                   g.info.mobs.size(), serial_ms / turn_iterations,
+		                   WorkerPool::shared().thread_count(), pool_ms / turn_iterations);
+		profiling_results.push_back(str);
+
+		// Once a mob moved, every lookup refills just its own mob, and all of
+		// them have to match a fresh flood fill.
+		{
+			MobPaths mob_paths;
+			mob_paths.compute(g.arena, g.info);
+
+			PathTree tree(g.size);
+			BucketQueue queue(MAX_MOVE_COST + MIN_MOVE_COST, g.size);
+			float lookup_ms = 0;
+			int mismatches = 0;
+
+			for (int i = 0; i < turn_iterations; ++i) {
+				auto moved = g.info.mobs[i];
+				for (auto diff : hex_directions) {
+					auto next = moved.c + diff;
+					if (moved.hp > 0 && g.arena.is_valid_coord(next) &&
+					    g.arena.hexes(next) != HexType::Wall && !g.info.occupied(next)) {
+						g.info.move_mob(moved, next);
+						break;
+					}
+				}
+
+				ss.start();
+				for (auto mob : g.info.mobs) {
+					mob_paths.of(mob, g.arena, g.info);
+				}
+				lookup_ms += ss.ms_f();
+
+				for (auto mob : g.info.mobs) {
+					if (mob.hp <= 0) continue;
+
+					auto& paths = mob_paths.of(mob, g.arena, g.info);
+					g.arena.flood_fill(mob.c, g.info, tree, queue);
+
+					for (int y = 0; y < static_cast<int>(g.size); ++y) {
+						for (int x = 0; x < static_cast<int>(g.size); ++x) {
+							if (paths.distance({ x, y }) != tree.distance({ x, y })) {
+								mismatches++;
+							}
+						}
+					}
+				}
+			}
+
+			str = fmt::sprintf("paths of %d mobs looked up after a move: %fms, mismatches: %d",
+			                   g.info.mobs.size(), lookup_ms / turn_iterations, mismatches);
+			profiling_results.push_back(str);
+		}
+
+		// Random walks through the actions of a game, every undo has to bring
+		// back exactly the state from before the action.
+		{
+			auto state = DummySimulation::starting_position(12, 5, mob_gen.split(2));
+
+			Rng action_gen(0);
+			ActionJournal journal(1000, state.info.mobs.size());
+			std::vector<GameState> snapshots;
+			std::vector<Action> actions;
+
+			int applied = 0;
+			int mismatches = 0;
+			for (int step = 0; step < 20000; ++step) {
+				if (!snapshots.empty() && (snapshots.size() >= 200 || action_gen() % 3 == 0)) {
+					journal.undo(state);
+					if (!same_state(state, snapshots.back())) {
+						mismatches++;
+					}
+					snapshots.pop_back();
+				} else {
+					state.legal_actions(actions);
+					snapshots.push_back(state);
+					journal.apply(state, actions[action_gen() % actions.size()]);
+					applied++;
+				}
+			}
+
+			int journal_iterations = 10000;
+			std::size_t taken = 0;
+			ss.start();
+			for (int i = 0; i < journal_iterations; ++i) {
+				while (journal.size() < 100) {
+					state.legal_actions(actions);
+					journal.apply(state, actions[action_gen() % actions.size()]);
+				}
+				while (!journal.empty()) {
+					journal.undo(state);
+					taken++;
+				}
+			}
+
+			str = fmt::sprintf("action journal %d random actions, mismatches: %d, apply and undo %fus per action",
+			                   applied, mismatches, ss.ms_f() / taken * 1000);
+			profiling_results.push_back(str);
+		}
+
+		// Zobrist hashes of a few million states from random walks with walls
+		// toggled along the way. The incremental hash has to match the one
+		// computed from scratch, and states that differ shouldn't share a hash.
+		{
+			auto state = DummySimulation::starting_position(12, 5, mob_gen.split(3));
+
+			Rng hash_gen(0);
+			std::uniform_int_distribution<int> coord_dis(0, static_cast<int>(state.size) - 1);
+
+			ActionJournal journal(64, state.info.mobs.size());
+			std::vector<Action> actions;
+			std::vector<std::pair<std::uint64_t, std::uint64_t>> seen;
+
+			int state_count = 2000000;
+			int mismatches = 0;
+			seen.reserve(state_count);
+
+			for (int step = 0; step < state_count; ++step) {
+				if (step % 16 == 0) {
+					Coord c(coord_dis(hash_gen), coord_dis(hash_gen));
+					if (!state.info.occupied(c)) {
+						state.set_hex(c, state.hexes(c) == HexType::Wall ? HexType::Empty : HexType::Wall);
+					}
+				} else if (!journal.empty() && (journal.size() >= 64 || hash_gen() % 4 == 0)) {
+					journal.undo(state);
+				} else {
+					state.legal_actions(actions);
+					journal.apply(state, actions[hash_gen() % actions.size()]);
+				}
+
+				if (step % 1000 == 0 && state.hash() != state.compute_hash()) {
+					mismatches++;
+				}
+
+				seen.emplace_back(state.hash(), fingerprint(state));
+			}
+
+			std::sort(seen.begin(), seen.end());
+			seen.erase(std::unique(seen.begin(), seen.end()), seen.end());
+
+			int collisions = 0;
+			for (std::size_t i = 1; i < seen.size(); ++i) {
+				if (seen[i].first == seen[i - 1].first) {
+					collisions++;
+				}
+			}
+
+			// The same random walk twice, reading the hash that apply keeps up to
+			// date after every action, then computing it from scratch instead.
+			GameState walk_start = state;
+			int hash_iterations = 1000000;
+			std::uint64_t checksum = 0;
+			float walk_ms[2];
+
+			for (int scratch = 0; scratch < 2; ++scratch) {
+				state = walk_start;
+				journal.clear();
+				Rng walk_gen(1);
+
+				ss.start();
+				for (int i = 0; i < hash_iterations; ++i) {
+					if (journal.size() >= 64) journal.clear();
+					state.legal_actions(actions);
+					journal.apply(state, actions[walk_gen() % actions.size()]);
+					checksum += scratch ? state.compute_hash() : state.hash();
+				}
+				walk_ms[scratch] = ss.ms_f();
+			}
+
+			str = fmt::sprintf("zobrist %d states, %d distinct, collisions: %d, mismatches: %d, %fus per action, from scratch %fus (%d)",
+			                   state_count, seen.size(), collisions, mismatches,
+			                   walk_ms[0] / hash_iterations * 1000, walk_ms[1] / hash_iterations * 1000, checksum & 1);
+			profiling_results.push_back(str);
+		}
+
+		// Picking by inverting the layout has to agree with checking every hex.
+		Rng pick_gen(0);
+		std::uniform_real_distribution<float> pick_dis(-1.0f, 6.0f);
+
+		std::vector<Position> points(100000);
+		for (auto& p : points) {
+			p = { pick_dis(pick_gen), pick_dis(pick_gen) };
+		}
+
+		std::vector<Coord> picked;
+		ss.start();
+		g.arena.hex_near(points, picked);
+		auto pick_ms = ss.ms_f();
+
+		int mismatches = 0;
 		ss.start();
+		for (std::size_t i = 0; i < points.size(); ++i) {
+			auto expected = g.arena.hex_near_exhaustive(points[i]);
+			if (picked[i] != expected &&
+			    (g.arena.hex_center(picked[i]) - points[i]).distance() > (g.arena.hex_center(expected) - points[i]).distance()) {
+				mismatches++;
+			}
+		}
+
+		str = fmt::sprintf("hex_near %d points took %fms, exhaustive %fms, mismatches: %d", points.size(), pick_ms, ss.ms_f(), mismatches);
+		profiling_results.push_back(str);
+
 		DummySimulation sim;
-		sim.run();
+		auto stats = sim.run(10000);
 
-		str = fmt::sprintf("DummySimulation took %dms", ss.ms());
+		str = fmt::sprintf("DummySimulation %d playouts took %fms: %f playouts/s, %f turns/s, %f actions/s",
+		                   stats.playouts, stats.ms, stats.playouts / stats.ms * 1000,
+		                   stats.turns / stats.ms * 1000, stats.actions / stats.ms * 1000);
 		profiling_results.push_back(str);
+
+		// The same games on a single thread and on every core have to end the
+		// same way, only faster.
+		{
+			auto initial = DummySimulation::starting_position(10, 5, Rng(0));
+			std::size_t games = 20000;
+
+			WorkerPool single(1);
+			auto serial = PlayoutFarm(initial, 42, single).run(games);
+			auto parallel = PlayoutFarm(initial, 42).run(games);
+
+			bool same = serial.wins == parallel.wins && serial.turns == parallel.turns &&
+				serial.actions == parallel.actions && serial.lengths.buckets == parallel.lengths.buckets;
+
+			str = fmt::sprintf("PlayoutFarm %d playouts: 1 thread %fms, %d threads %fms, %fx speedup, reproducible: %s",
+			                   games, serial.ms, WorkerPool::shared().thread_count(), parallel.ms,
+			                   serial.ms / parallel.ms, same ? "yes" : "NO");
+			profiling_results.push_back(str);
+		}
+	}
+
+	void Histogram::add(std::uint64_t value)
+	{
+		std::size_t bucket = 0;
+		while (value >> bucket) {
+			bucket++;
+		}
+		buckets[bucket]++;
+	}
+
+	void Histogram::merge(const Histogram& other)
+	{
+		for (std::size_t i = 0; i < buckets.size(); ++i) {
+			buckets[i] += other.buckets[i];
+		}
+	}
+
+	std::size_t Histogram::count() const
+	{
+		std::size_t total = 0;
+		for (auto count : buckets) {
+			total += count;
+		}
+		return total;
+	}
+
+	std::uint64_t Histogram::percentile(float fraction) const
+	{
+		auto rank = static_cast<std::size_t>(fraction * count());
+		std::size_t seen = 0;
+
+		for (std::size_t i = 0; i < buckets.size(); ++i) {
+			seen += buckets[i];
+			if (seen > rank) {
+				return i == 64 ? std::numeric_limits<std::uint64_t>::max() : (std::uint64_t(1) << i) - 1;
+			}
+		}
+
+		return std::numeric_limits<std::uint64_t>::max();
+	}
+
+	void PlayoutStats::merge(const PlayoutStats& other)
+	{
+		playouts += other.playouts;
+		turns += other.turns;
+		actions += other.actions;
+		draws += other.draws;
+
+		if (wins.size() < other.wins.size()) {
+			wins.resize(other.wins.size());
+		}
+		for (std::size_t i = 0; i < other.wins.size(); ++i) {
+			wins[i] += other.wins[i];
+		}
+
+		lengths.merge(other.lengths);
+		game_us.merge(other.game_us);
+	}
+
+	DummySimulation::DummySimulation(std::size_t size, int mobs_per_team, std::uint64_t seed)
+		: DummySimulation(starting_position(size, mobs_per_team, model::Rng(seed).split(0)), seed) {}
+
+	DummySimulation::DummySimulation(const model::GameState& initial, std::uint64_t seed)
+		: initial_(initial), state_(initial), gen_(seed)
+	{
+		// Ending the turn, a step in each direction and every ability at every mob.
+		actions_.reserve(1 + 6 + ABILITY_COUNT * initial.info.mobs.size());
+	}
+
+	model::GameState DummySimulation::starting_position(std::size_t size, int mobs_per_team, model::Rng rng)
+	{
+		using namespace model;
+
+		GameState state(size);
+		auto& info = state.info;
+		auto first = info.register_team(playout_player);
+		auto second = info.register_team(playout_player);
+
+		std::size_t mob_count = std::min<std::size_t>(2 * mobs_per_team, size * size);
+		while (info.mobs.size() < mob_count) {
+			auto mob = generator::random_mob(info.mobs.size() < mob_count / 2 ? first : second, size, rng);
+			if (!info.occupied(mob.c)) {
+				info.add_mob(mob);
+			}
+		}
+
+		state.start_turn();
+		return state;
+	}
+
+	void DummySimulation::seed(std::uint64_t seed, std::uint64_t stream)
+	{
+		gen_ = model::Rng(seed, stream);
 	}
 
-	void DummySimulation::run()
+	int DummySimulation::playout(PlayoutStats& stats)
 	{
 		using namespace model;
 
-		std::random_device rd;
-		std::mt19937 gen(rd());
+		Stopwatch s;
+
+		// Assigning to a state of the same size reuses its buffers.
+		state_ = initial_;
+
+		int winner = -1;
+		int turns = 0;
+
+		while (turns < max_turns) {
+			state_.legal_actions(actions_);
+			auto action = actions_[gen_.below(static_cast<std::uint32_t>(actions_.size()))];
 
-		std::size_t map_size = 3;
+			if (action.type == ActionType::EndTurn && state_.turn.is_last(state_.info)) {
+				turns++;
+			}
 
-		GameInstance game(map_size);
+			state_.apply(action);
+			stats.actions++;
 
-		Arena& arena = game.arena;
-		PlayerInfo& info = game.info;
+			if (action.type == ActionType::UseAbility) {
+				winner = state_.winning_team();
+				if (winner >= 0) break;
+			}
+		}
+
+		stats.playouts++;
+		stats.turns += turns;
+		stats.lengths.add(turns);
+		stats.game_us.add(static_cast<std::uint64_t>(s.ms_f() * 1000));
 
-		constexpr int SIM_TIME = 10000000;
+		if (winner < 0) {
+			stats.draws++;
+		} else {
+			if (stats.wins.size() <= static_cast<std::size_t>(winner)) {
+				stats.wins.resize(winner + 1);
+			}
+			stats.wins[winner]++;
+		}
 
-		std::uniform_int_distribution<int> action_dis(0, 6);
-		std::uniform_int_distribution<int> move_dis(-2, 2);
+		return winner;
+	}
 
-		double total_time = 0;
-		std::size_t iterations = 0;
+	PlayoutStats DummySimulation::run(std::size_t playouts)
+	{
+		PlayoutStats stats;
+		stats.wins.resize(initial_.info.teams.size());
 
 		Stopwatch s;
-		for (int i = 0; i < SIM_TIME; ++i) {
-			auto mob_list = game.start_turn();
-
-			std::cerr << "!!! SIMULATION TEMPORARILY DISABLED !!!" << std::endl;
-			//for (auto mob : mob_list) {
-			//	int roll = action_dis(gen);
-
-			//	// Take a random step
-			//	if (roll == 0) {
-			//		mob->move(arena, {move_dis(gen), move_dis(gen)});
-			//	} else {
-			//		// Use a random ability
-			//		mob->use_ability(roll - 1, Target{});
-			//	}
-			//}
-			iterations++;
-		}
-		total_time += s.ms();
-
-		fmt::printf("Simulated %d iterations, took: %fms, per second: %i\titeration: %fms\n",
-		            iterations,
-		            total_time,
-		            (int)(iterations / total_time * 1000),
-		            ((float)total_time) / iterations);
+		for (std::size_t i = 0; i < playouts; ++i) {
+			playout(stats);
+		}
+		stats.ms = s.ms_f();
+
+		float seconds = stats.ms / 1000.0f;
+		fmt::printf("Simulated %d playouts, %d turns, %d actions, %d draws, took: %fms\n"
+		            "playouts per second: %f\tturns per second: %f\tactions per second: %f\n",
+		            stats.playouts, stats.turns, stats.actions, stats.draws, stats.ms,
+		            stats.playouts / seconds, stats.turns / seconds, stats.actions / seconds);
+
+		return stats;
+	}
+
+	PlayoutFarm::PlayoutFarm(const model::GameState& initial, std::uint64_t master_seed, model::WorkerPool& pool)
+		: initial_(initial), master_seed_(master_seed), pool_(pool)
+	{
+		shards_.reserve(pool.thread_count());
+		for (std::size_t i = 0; i < pool.thread_count(); ++i) {
+			shards_.emplace_back(initial_);
+		}
+	}
+
+	PlayoutStats PlayoutFarm::run(std::size_t games)
+	{
+		std::vector<PlayoutStats> results(shards_.size());
+
+		Stopwatch s;
+
+		// Every job only touches its own shard and stats, and keeps the counters
+		// on its own stack while playing so that they don't share cache lines.
+		pool_.run(shards_.size(), [&](std::size_t job) {
+			auto& sim = shards_[job];
+			std::size_t first = games * job / shards_.size();
+			std::size_t last = games * (job + 1) / shards_.size();
+
+			PlayoutStats stats;
+			for (std::size_t game = first; game < last; ++game) {
+				sim.seed(master_seed_, game);
+				sim.playout(stats);
+			}
+
+			results[job] = stats;
+		});
+
+		PlayoutStats total;
+		total.wins.resize(initial_.info.teams.size());
+		for (auto& result : results) {
+			total.merge(result);
+		}
+		total.ms = s.ms_f();
+
+		float seconds = total.ms / 1000.0f;
+		fmt::printf("Farmed %d playouts on %d threads in %fms, %f playouts per second, %f actions per second\n",
+		            total.playouts, shards_.size(), total.ms, total.playouts / seconds, total.actions / seconds);
+
+		for (std::size_t team = 0; team < total.wins.size(); ++team) {
+			fmt::printf("team %d won %f%%\n", team, 100.0f * total.wins[team] / total.playouts);
+		}
+
+		fmt::printf("draws %f%%, turns per game median <= %d, p99 <= %d, microseconds per game median <= %d, p99 <= %d\n",
+		            100.0f * total.draws / total.playouts,
+		            total.lengths.percentile(0.5f), total.lengths.percentile(0.99f),
+		            total.game_us.percentile(0.5f), total.game_us.percentile(0.99f));
+
+		return total;
 	}
 }
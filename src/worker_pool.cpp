@@ -0,0 +1,87 @@
+#include <cassert>
+#include <worker_pool.hpp>
+
+namespace model
+{
+	namespace
+	{
+		// Pool whose job this thread is running, if any.
+		thread_local const WorkerPool* running_pool = nullptr;
+	}
+
+	WorkerPool::WorkerPool(std::size_t threads) {
+		for (std::size_t i = 1; i < threads; ++i) {
+			threads_.emplace_back([this]() { work(); });
+		}
+	}
+
+	WorkerPool::~WorkerPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopping_ = true;
+		}
+		work_ready_.notify_all();
+
+		for (auto& thread : threads_) {
+			thread.join();
+		}
+	}
+
+	void WorkerPool::work() {
+		unsigned seen = 0;
+
+		while (true) {
+			std::unique_lock<std::mutex> lock(mutex_);
+			work_ready_.wait(lock, [&]() { return stopping_ || batch_ != seen; });
+
+			if (stopping_) return;
+			seen = batch_;
+
+			lock.unlock();
+			drain();
+			lock.lock();
+
+			if (--busy_ == 0) {
+				work_done_.notify_one();
+			}
+		}
+	}
+
+	void WorkerPool::drain() {
+		auto outer = running_pool;
+		running_pool = this;
+
+		for (std::size_t i = next_job_++; i < job_count_; i = next_job_++) {
+			(*job_)(i);
+		}
+
+		running_pool = outer;
+	}
+
+	void WorkerPool::run(std::size_t jobs, const std::function<void(std::size_t)>& job) {
+		// A job starting a batch on its own pool would replace the batch it's part of.
+		assert(running_pool != this);
+		if (jobs == 0) return;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			job_ = &job;
+			job_count_ = jobs;
+			next_job_ = 0;
+			busy_ = threads_.size();
+			batch_++;
+		}
+		work_ready_.notify_all();
+
+		drain();
+
+		// The job only lives as long as this call, wait until nobody uses it anymore.
+		std::unique_lock<std::mutex> lock(mutex_);
+		work_done_.wait(lock, [&]() { return busy_ == 0; });
+	}
+
+	WorkerPool& WorkerPool::shared() {
+		static WorkerPool pool;
+		return pool;
+	}
+}